@@ -0,0 +1,167 @@
+/*
+  Reader for the gap-encoded archive written by prime_finder (-format gaps).
+
+  File layout, all fixed-size fields little-endian:
+
+    PrimeArchiveHeader (64 bytes)
+    block data: for every block, the gaps between its consecutive primes as LEB128 varints of
+                gap / 2 (the single odd gap, 2 -> 3, is stored as 0). A block's first prime is not
+                in the data but in its index entry.
+    index:      block_count PrimeArchiveIndexEntry records at index_offset
+
+  Every block except the last holds exactly block_size primes, so the block of the prime with
+  rank r is r / block_size, and the block containing a value is found by binary search over the
+  index. Only that one block is decoded:
+
+    PrimeArchiveReader archive("primes.gaps");
+    uint64_t p = archive.at(1000000);          // the 1000001st prime in the archive
+    uint64_t r = archive.rank_of(123456789);    // primes in the archive below 123456789
+*/
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+constexpr char PRIME_ARCHIVE_MAGIC[8] = {'P', 'R', 'I', 'M', 'E', 'G', 'A', 'P'};
+constexpr std::uint32_t PRIME_ARCHIVE_VERSION = 1;
+
+struct PrimeArchiveHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t block_size;  // Primes per block
+    std::uint64_t a;           // Searched range
+    std::uint64_t b;
+    std::uint64_t count;       // Primes in the archive, always stored ascending
+    std::uint64_t block_count;
+    std::uint64_t index_offset;
+    std::uint64_t reserved;
+};
+static_assert(sizeof(PrimeArchiveHeader) == 64,
+              "PrimeArchiveHeader must match the on-disk layout");
+
+struct PrimeArchiveIndexEntry {
+    std::uint64_t first_prime;
+    std::uint64_t offset;  // File offset of the block's gap data
+    std::uint32_t count;   // Primes in the block, including first_prime
+    std::uint32_t reserved;
+};
+static_assert(sizeof(PrimeArchiveIndexEntry) == 24,
+              "PrimeArchiveIndexEntry must match the on-disk layout");
+
+// Maps a -format gaps archive and answers rank and value queries by decoding a single block.
+// Throws std::runtime_error if the file cannot be mapped or is not a valid archive.
+class PrimeArchiveReader {
+   public:
+    explicit PrimeArchiveReader(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(header_)) {
+            ::close(fd);
+            throw std::runtime_error(path + " is too small to be a prime archive");
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("Cannot map " + path);
+        data_ = static_cast<const unsigned char *>(mapped);
+
+        std::memcpy(&header_, data_, sizeof(header_));
+        bool valid =
+            std::memcmp(header_.magic, PRIME_ARCHIVE_MAGIC, sizeof(PRIME_ARCHIVE_MAGIC)) == 0 &&
+            header_.version == PRIME_ARCHIVE_VERSION && header_.block_size > 0 &&
+            header_.index_offset <= size_ &&
+            header_.block_count <= (size_ - header_.index_offset) / sizeof(PrimeArchiveIndexEntry);
+        if (!valid) {
+            ::munmap(const_cast<unsigned char *>(data_), size_);
+            throw std::runtime_error(path + " is not a valid prime archive");
+        }
+    }
+
+    ~PrimeArchiveReader() { ::munmap(const_cast<unsigned char *>(data_), size_); }
+
+    PrimeArchiveReader(const PrimeArchiveReader &) = delete;
+    PrimeArchiveReader &operator=(const PrimeArchiveReader &) = delete;
+
+    const PrimeArchiveHeader &header() const { return header_; }
+    std::uint64_t count() const { return header_.count; }
+    std::uint64_t block_count() const { return header_.block_count; }
+
+    PrimeArchiveIndexEntry entry(std::uint64_t block) const {
+        PrimeArchiveIndexEntry e;
+        std::memcpy(&e, data_ + header_.index_offset + block * sizeof(e), sizeof(e));
+        return e;
+    }
+
+    // Appends every prime of `block` to out.
+    void decode_block(std::uint64_t block, std::vector<std::uint64_t> &out) const {
+        PrimeArchiveIndexEntry e = entry(block);
+        const unsigned char *p = data_ + e.offset;
+        std::uint64_t prime = e.first_prime;
+        out.push_back(prime);
+        for (std::uint32_t i = 1; i < e.count; ++i) {
+            prime = next(prime, p);
+            out.push_back(prime);
+        }
+    }
+
+    // The prime with the given rank (0-based). rank must be < count().
+    std::uint64_t at(std::uint64_t rank) const {
+        PrimeArchiveIndexEntry e = entry(rank / header_.block_size);
+        const unsigned char *p = data_ + e.offset;
+        std::uint64_t prime = e.first_prime;
+        for (std::uint64_t i = rank % header_.block_size; i > 0; --i) prime = next(prime, p);
+        return prime;
+    }
+
+    // Number of primes in the archive that are smaller than value, which is also the rank of the
+    // first prime >= value (count() if there is none).
+    std::uint64_t rank_of(std::uint64_t value) const {
+        std::uint64_t lo = 0;
+        std::uint64_t hi = header_.block_count;
+        while (lo < hi) {  // First block whose first prime is >= value
+            std::uint64_t mid = lo + (hi - lo) / 2;
+            if (entry(mid).first_prime < value) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo == 0) return 0;
+
+        std::uint64_t block = lo - 1;
+        PrimeArchiveIndexEntry e = entry(block);
+        const unsigned char *p = data_ + e.offset;
+        std::uint64_t prime = e.first_prime;
+        std::uint32_t i = 0;  // Ends at the first prime >= value, or at e.count if there is none
+        while (prime < value && ++i < e.count) {
+            prime = next(prime, p);
+        }
+        return block * header_.block_size + i;
+    }
+
+   private:
+    static std::uint64_t next(std::uint64_t prime, const unsigned char *&p) {
+        std::uint64_t half_gap = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            unsigned char byte = *p++;
+            half_gap |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        return prime + (half_gap == 0 ? 1 : 2 * half_gap);
+    }
+
+    PrimeArchiveHeader header_;
+    const unsigned char *data_ = nullptr;
+    std::size_t size_ = 0;
+};
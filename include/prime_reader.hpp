@@ -0,0 +1,126 @@
+/*
+  Reader for the binary output of prime_finder (-format bin).
+
+  File layout, all fields little-endian:
+
+    offset  size  field
+         0     8  magic "PRIMEBIN"
+         8     4  version (1)
+        12     1  width: bytes per prime, 4 (uint32) or 8 (uint64)
+        13     1  descending: 1 if written with -sort desc
+        14     2  reserved, zero
+        16     8  a, start of the searched range
+        24     8  b, end of the searched range
+        32     8  count, number of primes that follow
+        40        count * width bytes of primes
+
+  The payload starts at an 8-byte aligned offset, so on little-endian hosts the mapped file can be
+  used in place as an array of uint32_t / uint64_t without parsing:
+
+    PrimeFileReader file("primes.bin");
+    for (uint64_t p : file.primes<uint64_t>()) ...
+*/
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+constexpr char PRIME_FILE_MAGIC[8] = {'P', 'R', 'I', 'M', 'E', 'B', 'I', 'N'};
+constexpr std::uint32_t PRIME_FILE_VERSION = 1;
+
+struct PrimeFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint8_t width;
+    std::uint8_t descending;
+    std::uint16_t reserved;
+    std::uint64_t a;
+    std::uint64_t b;
+    std::uint64_t count;
+};
+static_assert(sizeof(PrimeFileHeader) == 40, "PrimeFileHeader must match the on-disk layout");
+
+// Read-only view over a contiguous array of primes.
+template <typename T>
+class PrimeSpan {
+   public:
+    PrimeSpan(const T *data, std::size_t size) : data_(data), size_(size) {}
+
+    const T *begin() const { return data_; }
+    const T *end() const { return data_ + size_; }
+    const T *data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    T operator[](std::size_t i) const { return data_[i]; }
+
+   private:
+    const T *data_;
+    std::size_t size_;
+};
+
+// Maps a -format bin file into memory and exposes its primes as a PrimeSpan. Throws
+// std::runtime_error if the file cannot be mapped or is not a valid prime file.
+class PrimeFileReader {
+   public:
+    explicit PrimeFileReader(const std::string &path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("Cannot open " + path);
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(header_)) {
+            ::close(fd);
+            throw std::runtime_error(path + " is too small to be a prime file");
+        }
+        size_ = static_cast<std::size_t>(st.st_size);
+        void *mapped = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED) throw std::runtime_error("Cannot map " + path);
+        data_ = static_cast<const unsigned char *>(mapped);
+
+        std::memcpy(&header_, data_, sizeof(header_));
+        if (std::memcmp(header_.magic, PRIME_FILE_MAGIC, sizeof(PRIME_FILE_MAGIC)) != 0 ||
+            header_.version != PRIME_FILE_VERSION || (header_.width != 4 && header_.width != 8) ||
+            header_.count > (size_ - sizeof(header_)) / header_.width) {
+            ::munmap(const_cast<unsigned char *>(data_), size_);
+            throw std::runtime_error(path + " is not a valid prime file");
+        }
+    }
+
+    ~PrimeFileReader() { ::munmap(const_cast<unsigned char *>(data_), size_); }
+
+    PrimeFileReader(const PrimeFileReader &) = delete;
+    PrimeFileReader &operator=(const PrimeFileReader &) = delete;
+
+    const PrimeFileHeader &header() const { return header_; }
+    std::uint64_t a() const { return header_.a; }
+    std::uint64_t b() const { return header_.b; }
+    std::uint64_t count() const { return header_.count; }
+    bool descending() const { return header_.descending != 0; }
+
+    // The primes, in file order. T must be uint32_t or uint64_t matching the stored width.
+    template <typename T>
+    PrimeSpan<T> primes() const {
+        static_assert(sizeof(T) == 4 || sizeof(T) == 8, "primes are stored as 4 or 8 bytes");
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+        static_assert(sizeof(T) == 0, "in-place access requires a little-endian host");
+#endif
+        if (sizeof(T) != header_.width) {
+            throw std::runtime_error("prime file stores " + std::to_string(header_.width) +
+                                     "-byte primes");
+        }
+        return PrimeSpan<T>(reinterpret_cast<const T *>(data_ + sizeof(header_)),
+                            static_cast<std::size_t>(header_.count));
+    }
+
+   private:
+    PrimeFileHeader header_;
+    const unsigned char *data_ = nullptr;
+    std::size_t size_ = 0;
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "sieve.hpp"
+
+// Directory of fully sieved wheel blocks shared by every run given the same -cache. Block k
+// covers [k * BLOCK_SPAN, (k + 1) * BLOCK_SPAN) and is stored as its raw BLOCK_BYTES wheel bytes in
+// a file of its own, so a run maps the blocks earlier runs produced and only sieves the rest.
+//
+// A block file only appears under its final name through rename() once it is complete, so readers
+// never see a partial block and take no lock; a mapping stays valid even if another run evicts
+// the file meanwhile. Eviction, oldest modification time first (hits touch their file), is
+// serialized between processes with flock() on DIR/lock.
+class SieveCache {
+   public:
+    static constexpr std::size_t BLOCK_BYTES = 128 * 1024;
+    static constexpr std::uint64_t BLOCK_SPAN = 30 * static_cast<std::uint64_t>(BLOCK_BYTES);
+
+    // Creates dir if needed. Throws std::runtime_error if it cannot be used.
+    SieveCache(std::string dir, std::uint64_t max_bytes)
+        : dir_(std::move(dir)), max_bytes_(max_bytes) {
+        if (::mkdir(dir_.c_str(), 0755) != 0 && errno != EEXIST) {
+            throw std::runtime_error("Cannot create " + dir_ + ": " + std::strerror(errno));
+        }
+        struct stat st;
+        if (::stat(dir_.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+            throw std::runtime_error(dir_ + " is not a directory");
+        }
+    }
+
+    SieveCache(const SieveCache &) = delete;
+    SieveCache &operator=(const SieveCache &) = delete;
+
+    // Largest number a run ending at b may sieve: the end of b's block, unless that block runs
+    // past 2^64 (such a block is never stored). Base primes must reach its square root.
+    static std::uint64_t sieve_limit(std::uint64_t b) {
+        std::uint64_t low = b / BLOCK_SPAN * BLOCK_SPAN;
+        return low > UINT64_MAX - (BLOCK_SPAN - 1) ? b : low + BLOCK_SPAN - 1;
+    }
+
+    // Calls on_view(view) with sieved views covering [start, end] in ascending order, one or more
+    // per block. A cached block is mapped. A missing block that overlaps [start, end] by at least
+    // half is sieved whole and stored; smaller overlaps are sieved on their own and not stored.
+    // base_primes must reach sqrt(sieve_limit(end)).
+    template <typename Fn>
+    void for_each_segment(std::uint64_t start, std::uint64_t end,
+                          const std::vector<std::uint32_t> &base_primes, Fn on_view) {
+        auto sieve_part = [&](std::uint64_t lo, std::uint64_t hi) {
+            sieve_segments(lo, hi, base_primes,
+                           [&](const Wheel30Bitmap &segment) { on_view(segment.view()); });
+        };
+
+        std::vector<std::uint8_t> block;
+        for (std::uint64_t low = start / BLOCK_SPAN * BLOCK_SPAN;; low += BLOCK_SPAN) {
+            bool storable = low <= UINT64_MAX - (BLOCK_SPAN - 1);
+            std::uint64_t last = storable ? low + BLOCK_SPAN - 1 : UINT64_MAX;
+            std::uint64_t lo = std::max(start, low);
+            std::uint64_t hi = std::min(end, last);
+
+            if (storable && load(low, on_view)) {
+                ++hits_;
+            } else if (storable && hi - lo >= BLOCK_SPAN / 2) {
+                block.resize(BLOCK_BYTES);
+                sieve_segments(low, last, base_primes, [&](const Wheel30Bitmap &segment) {
+                    std::memcpy(block.data() + (segment.low() - low) / 30, segment.data(),
+                                segment.size());
+                });
+                on_view(Wheel30View(block.data(), low, BLOCK_BYTES));
+                if (store(low, block)) ++stored_;
+            } else {
+                sieve_part(lo, hi);
+            }
+            if (end <= last) break;
+        }
+    }
+
+    // Evicts the least recently used blocks until the directory is within the size cap again.
+    // Returns how many blocks were removed.
+    std::uint64_t trim() {
+        std::string lock_path = dir_ + "/lock";
+        int lock_fd = ::open(lock_path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (lock_fd < 0) return 0;
+        if (::flock(lock_fd, LOCK_EX) != 0) {
+            ::close(lock_fd);
+            return 0;
+        }
+
+        struct Entry {
+            std::string path;
+            struct timespec mtime;
+            std::uint64_t bytes;
+        };
+        std::vector<Entry> entries;
+        std::uint64_t total = 0;
+        std::string prefix = file_prefix();
+        if (DIR *dir = ::opendir(dir_.c_str())) {
+            while (struct dirent *e = ::readdir(dir)) {
+                std::string name = e->d_name;
+                if (name.compare(0, prefix.size(), prefix) != 0) continue;
+                if (name.find(".tmp") != std::string::npos) continue;
+                std::string path = dir_ + "/" + name;
+                struct stat st;
+                if (::stat(path.c_str(), &st) != 0) continue;
+                entries.push_back({path, st.st_mtim, static_cast<std::uint64_t>(st.st_size)});
+                total += entries.back().bytes;
+            }
+            ::closedir(dir);
+        }
+
+        std::sort(entries.begin(), entries.end(), [](const Entry &x, const Entry &y) {
+            return x.mtime.tv_sec != y.mtime.tv_sec ? x.mtime.tv_sec < y.mtime.tv_sec
+                                                    : x.mtime.tv_nsec < y.mtime.tv_nsec;
+        });
+        std::uint64_t evicted = 0;
+        for (const Entry &entry : entries) {
+            if (total <= max_bytes_) break;
+            if (::unlink(entry.path.c_str()) == 0) {
+                total -= entry.bytes;
+                ++evicted;
+            }
+        }
+
+        ::flock(lock_fd, LOCK_UN);
+        ::close(lock_fd);
+        return evicted;
+    }
+
+    std::uint64_t hits() const { return hits_; }
+    std::uint64_t stored() const { return stored_; }
+
+   private:
+    std::string file_prefix() const { return "wheel30-" + std::to_string(BLOCK_BYTES) + "-"; }
+
+    std::string block_path(std::uint64_t low) const {
+        return dir_ + "/" + file_prefix() + std::to_string(low / BLOCK_SPAN);
+    }
+
+    // Maps the block starting at low and passes it to on_view. False if it is not cached.
+    template <typename Fn>
+    bool load(std::uint64_t low, Fn &on_view) {
+        int fd = ::open(block_path(low).c_str(), O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) != BLOCK_BYTES) {
+            ::close(fd);
+            return false;
+        }
+        void *mapped = ::mmap(nullptr, BLOCK_BYTES, PROT_READ, MAP_SHARED, fd, 0);
+        ::futimens(fd, nullptr);  // Marks the block as recently used for trim()
+        ::close(fd);
+        if (mapped == MAP_FAILED) return false;
+
+        on_view(Wheel30View(static_cast<const std::uint8_t *>(mapped), low, BLOCK_BYTES));
+        ::munmap(mapped, BLOCK_BYTES);
+        return true;
+    }
+
+    // Writes the block to a temporary file and renames it into place. Failures only cost the
+    // cache entry.
+    bool store(std::uint64_t low, const std::vector<std::uint8_t> &block) {
+        std::string path = block_path(low);
+        std::string tmp_path =
+            path + ".tmp." + std::to_string(::getpid()) + "." + std::to_string(next_tmp_++);
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) return false;
+
+        const std::uint8_t *data = block.data();
+        std::size_t left = block.size();
+        while (left > 0) {
+            ssize_t written = ::write(fd, data, left);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) break;
+            data += written;
+            left -= static_cast<std::size_t>(written);
+        }
+        bool ok = ::close(fd) == 0 && left == 0 && ::rename(tmp_path.c_str(), path.c_str()) == 0;
+        if (!ok) ::unlink(tmp_path.c_str());
+        return ok;
+    }
+
+    std::string dir_;
+    std::uint64_t max_bytes_;
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> stored_{0};
+    std::atomic<std::uint64_t> next_tmp_{0};
+};
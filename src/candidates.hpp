@@ -0,0 +1,161 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "format.hpp"
+#include "primality.hpp"
+
+// Layout of an -input file.
+enum class InputFormat { text, bin };
+
+// Whole candidates taken from the input in one go: a view into the mapped file, or bytes read from
+// a pipe, which `owned` then holds.
+struct CandidateBatch {
+    const char *data = nullptr;
+    std::size_t size = 0;
+    std::vector<char> owned;
+};
+
+// Cuts an -input file (or stdin for "-") into batches of about BATCH_BYTES that end between two
+// candidates: text batches end at whitespace, binary ones after a whole 8-byte value. Regular files
+// are mapped; anything else is read batch by batch, the cut-off part carried over to the next one.
+// Not thread-safe: batches are taken one at a time, in input order.
+class CandidateReader {
+   public:
+    static constexpr std::size_t BATCH_BYTES = 256 << 10;
+
+    CandidateReader(const std::string &path, InputFormat format) : format_(format) {
+        fd_ = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+        if (fd_ < 0) throw std::runtime_error("Cannot open " + path + ": " + std::strerror(errno));
+        struct stat st;
+        if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+            if (map != MAP_FAILED) {
+                map_ = static_cast<const char *>(map);
+                map_size_ = st.st_size;
+                madvise(map, map_size_, MADV_SEQUENTIAL);
+            }
+        }
+    }
+
+    CandidateReader(const CandidateReader &) = delete;
+    CandidateReader &operator=(const CandidateReader &) = delete;
+
+    ~CandidateReader() {
+        if (map_) munmap(const_cast<char *>(map_), map_size_);
+        if (fd_ != STDIN_FILENO) close(fd_);
+    }
+
+    // The next batch; false at the end of the input or on a read error (see error()).
+    bool next(CandidateBatch &batch) {
+        if (map_) {
+            if (position_ == map_size_) return false;
+            std::size_t size = std::min(BATCH_BYTES, map_size_ - position_);
+            if (position_ + size < map_size_) size = cut(map_ + position_, size);
+            batch.data = map_ + position_;
+            batch.size = size;
+            position_ += size;
+            return true;
+        }
+
+        batch.owned.swap(carry_);
+        carry_.clear();
+        std::size_t have = batch.owned.size();
+        batch.owned.resize(std::max(have, BATCH_BYTES));
+        while (!end_ && have < BATCH_BYTES) {
+            ssize_t n = read(fd_, batch.owned.data() + have, BATCH_BYTES - have);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) error_ = errno;
+            if (n <= 0) {
+                end_ = true;
+                break;
+            }
+            have += n;
+        }
+        std::size_t size = end_ ? have : cut(batch.owned.data(), have);
+        carry_.assign(batch.owned.begin() + size, batch.owned.begin() + have);
+        batch.owned.resize(size);
+        batch.data = batch.owned.data();
+        batch.size = size;
+        return size > 0;
+    }
+
+    // errno of the read that failed, 0 if none did.
+    int error() const { return error_; }
+
+   private:
+    // Length of the longest prefix of data[0, size) that ends between two candidates, or size if
+    // there is none (a text batch without whitespace cannot hold a valid number anyway).
+    std::size_t cut(const char *data, std::size_t size) const {
+        if (format_ == InputFormat::bin) return size / 8 * 8;
+        for (std::size_t end = size; end > 0; --end) {
+            char c = data[end - 1];
+            if (c == '\n' || c == ' ' || c == '\t' || c == '\r') return end;
+        }
+        return size;
+    }
+
+    InputFormat format_;
+    int fd_;
+    const char *map_ = nullptr;
+    std::size_t map_size_ = 0;
+    std::size_t position_ = 0;
+    std::vector<char> carry_;
+    bool end_ = false;
+    int error_ = 0;
+};
+
+// Appends the candidates of batch to values. Text is decimal numbers below 2^64 separated by
+// whitespace, bin little-endian 64-bit values. Returns false, with the offending text in bad, on
+// anything else.
+inline bool parse_candidates(const CandidateBatch &batch, InputFormat format,
+                             std::vector<std::uint64_t> &values, std::string &bad) {
+    const char *p = batch.data;
+    const char *end = batch.data + batch.size;
+    if (format == InputFormat::bin) {
+        if (batch.size % 8 != 0) {
+            bad = "a trailing partial 8-byte value";
+            return false;
+        }
+        for (; p != end; p += 8) {
+            std::uint64_t value;
+            std::memcpy(&value, p, 8);
+            values.push_back(to_little_endian(value));
+        }
+        return true;
+    }
+
+    auto space = [](char c) { return c == '\n' || c == ' ' || c == '\t' || c == '\r'; };
+    while (true) {
+        while (p != end && space(*p)) ++p;
+        if (p == end) return true;
+        const char *token = p;
+        while (p != end && !space(*p)) ++p;
+        std::uint64_t value;
+        auto [parsed, error] = std::from_chars(token, p, value);
+        if (error != std::errc() || parsed != p) {
+            bad = "'" + std::string(token, std::min<std::size_t>(p - token, 40)) + "'";
+            return false;
+        }
+        values.push_back(value);
+    }
+}
+
+// The cheapest exact test for a candidate of any size: the hashed single-base Miller-Rabin test
+// below 2^32, the seven-base one above.
+inline bool is_prime_candidate(std::uint64_t n) {
+    return n <= UINT32_MAX ? is_prime_mr32(static_cast<std::uint32_t>(n))
+                           : is_prime_miller_rabin(n);
+}
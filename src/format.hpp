@@ -0,0 +1,285 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "../include/prime_archive.hpp"
+#include "../include/prime_reader.hpp"
+
+// Large output buffer in front of a file descriptor. Each full buffer goes out in a single
+// write(), or, when an offset is given, a single pwrite() at consecutive positions from that
+// offset, so several buffers can fill disjoint parts of one file concurrently.
+class OutputBuffer {
+   public:
+    static constexpr std::size_t BUFFER_SIZE = 4 << 20;
+
+    OutputBuffer(int fd, off_t offset, std::size_t capacity)
+        : fd_(fd), capacity_(capacity), buffer_(new char[capacity]), offset_(offset) {}
+
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+
+    // Returns room for at least `bytes` more bytes, flushing first if needed.
+    char *reserve(std::size_t bytes) {
+        if (capacity_ - used_ < bytes) flush();
+        return buffer_.get() + used_;
+    }
+
+    // Marks everything up to `end` (a pointer obtained from reserve()) as filled.
+    void commit(char *end) { used_ = static_cast<std::size_t>(end - buffer_.get()); }
+
+    void flush() {
+        const char *data = buffer_.get();
+        std::size_t left = used_;
+        while (left > 0 && ok_) {
+            ssize_t written =
+                offset_ < 0 ? ::write(fd_, data, left) : ::pwrite(fd_, data, left, offset_);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                ok_ = false;
+                break;
+            }
+            data += written;
+            left -= static_cast<std::size_t>(written);
+            if (offset_ >= 0) offset_ += written;
+        }
+        used_ = 0;
+    }
+
+    // False once any write to the descriptor has failed.
+    bool ok() const { return ok_; }
+
+   private:
+    int fd_;
+    std::size_t capacity_;
+    std::unique_ptr<char[]> buffer_;
+    std::size_t used_ = 0;
+    off_t offset_;
+    bool ok_ = true;
+};
+
+// Renders primes as tab-separated rows of `columns` values straight into an OutputBuffer with
+// std::to_chars. Row breaks come from a countdown instead of a modulo per value, and nothing is
+// flushed per line.
+//
+// A positioned writer renders one slice of a larger output: it starts the row layout at the
+// first_index-th value of the whole output and pwrite()s from `offset`.
+class TextWriter {
+   public:
+    static constexpr std::size_t MAX_ENTRY = 24;  // 20 digits of a uint64_t, '\t' and '\n'
+
+    TextWriter(int fd, int columns)
+        : out_(fd, -1, OutputBuffer::BUFFER_SIZE), columns_(columns), until_newline_(columns) {}
+
+    TextWriter(int fd, int columns, std::uint64_t first_index, off_t offset,
+               std::size_t buffer_size)
+        : out_(fd, offset, std::clamp(buffer_size, MAX_ENTRY, OutputBuffer::BUFFER_SIZE)),
+          columns_(columns),
+          until_newline_(columns - static_cast<int>(first_index % columns)) {}
+
+    template <typename T>
+    void write(T prime) {
+        char *p = out_.reserve(MAX_ENTRY);
+        p = std::to_chars(p, p + MAX_ENTRY, prime).ptr;
+        *p++ = '\t';
+        if (--until_newline_ == 0) {
+            *p++ = '\n';
+            until_newline_ = columns_;
+        }
+        out_.commit(p);
+    }
+
+    template <typename It>
+    void write(It first, It last) {
+        for (; first != last; ++first) write(*first);
+    }
+
+    // Terminates a partial last row and writes out whatever is buffered.
+    void finish() {
+        if (until_newline_ != columns_) {
+            char *p = out_.reserve(1);
+            *p++ = '\n';
+            out_.commit(p);
+            until_newline_ = columns_;
+        }
+        flush();
+    }
+
+    // Writes out whatever is buffered, leaving a partial row open.
+    void flush() { out_.flush(); }
+    bool ok() const { return out_.ok(); }
+
+   private:
+    OutputBuffer out_;
+    int columns_;
+    int until_newline_;
+};
+
+template <typename T>
+T to_little_endian(T value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    if constexpr (sizeof(T) == 8) return __builtin_bswap64(value);
+    if constexpr (sizeof(T) == 4) return __builtin_bswap32(value);
+    if constexpr (sizeof(T) == 2) return __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+// Writes primes as raw little-endian integers of their own width: the payload of a -format bin
+// file (see include/prime_reader.hpp). Positioned the same way as TextWriter.
+class BinaryWriter {
+   public:
+    explicit BinaryWriter(int fd, off_t offset = -1,
+                          std::size_t buffer_size = OutputBuffer::BUFFER_SIZE)
+        : out_(fd, offset, std::clamp<std::size_t>(buffer_size, 8, OutputBuffer::BUFFER_SIZE)) {}
+
+    template <typename T>
+    void write(T prime) {
+        char *p = out_.reserve(sizeof(T));
+        T value = to_little_endian(prime);
+        std::memcpy(p, &value, sizeof(T));
+        out_.commit(p + sizeof(T));
+    }
+
+    template <typename It>
+    void write(It first, It last) {
+        for (; first != last; ++first) write(*first);
+    }
+
+    void finish() { flush(); }
+    void flush() { out_.flush(); }
+    bool ok() const { return out_.ok(); }
+
+   private:
+    OutputBuffer out_;
+};
+
+// Header of a -format bin file holding `count` primes of type T from [a, b].
+template <typename T>
+PrimeFileHeader make_prime_file_header(std::uint64_t a, std::uint64_t b, std::uint64_t count,
+                                       bool descending) {
+    PrimeFileHeader header{};
+    std::memcpy(header.magic, PRIME_FILE_MAGIC, sizeof(header.magic));
+    header.version = to_little_endian(PRIME_FILE_VERSION);
+    header.width = sizeof(T);
+    header.descending = descending;
+    header.a = to_little_endian(a);
+    header.b = to_little_endian(b);
+    header.count = to_little_endian(count);
+    return header;
+}
+
+// Exact number of bytes TextWriter produces for `primes` (sorted ascending; the writer may walk
+// them in either direction) when they are values first_index .. first_index + size - 1 of the
+// output, excluding the newline finish() adds after a partial last row. Digit lengths come from
+// binary searches for the powers of ten, so nothing is formatted.
+template <typename T>
+std::uint64_t formatted_length(const std::vector<T> &primes, std::uint64_t first_index,
+                               int columns) {
+    std::uint64_t n = primes.size();
+    std::uint64_t bytes = n;  // One tab per value
+    std::uint64_t threshold = 1;
+    for (int digits = 1; digits <= std::numeric_limits<T>::digits10 + 1; ++digits) {
+        if (threshold > std::numeric_limits<T>::max()) break;
+        // Every value >= 10^(digits - 1) has at least `digits` digits
+        bytes += primes.end() - std::lower_bound(primes.begin(), primes.end(), threshold);
+        if (threshold > std::numeric_limits<std::uint64_t>::max() / 10) break;
+        threshold *= 10;
+    }
+    std::uint64_t newlines = (first_index + n) / columns - first_index / columns;
+    return bytes + newlines;
+}
+
+// Writes a -format gaps archive (see include/prime_archive.hpp) from primes given in ascending
+// order: varint half-gaps in blocks of block_size primes, the block index after the data, and the
+// header, which needs the final counts, last via pwrite(). The descriptor must be seekable.
+class GapArchiveWriter {
+   public:
+    static constexpr std::uint32_t BLOCK_SIZE = 4096;
+    static constexpr std::size_t MAX_VARINT = 10;
+
+    GapArchiveWriter(int fd, std::uint64_t a, std::uint64_t b,
+                     std::uint32_t block_size = BLOCK_SIZE)
+        : fd_(fd), out_(fd, -1, OutputBuffer::BUFFER_SIZE), a_(a), b_(b), block_size_(block_size) {
+        char *p = out_.reserve(sizeof(PrimeArchiveHeader));
+        std::memset(p, 0, sizeof(PrimeArchiveHeader));
+        out_.commit(p + sizeof(PrimeArchiveHeader));
+        position_ = sizeof(PrimeArchiveHeader);
+    }
+
+    template <typename T>
+    void write(T prime) {
+        if (count_ % block_size_ == 0) {
+            index_.push_back({prime, position_, 0, 0});
+        } else {
+            std::uint64_t half_gap = (prime - previous_) / 2;
+            char *start = out_.reserve(MAX_VARINT);
+            char *p = start;
+            while (half_gap >= 0x80) {
+                *p++ = static_cast<char>((half_gap & 0x7f) | 0x80);
+                half_gap >>= 7;
+            }
+            *p++ = static_cast<char>(half_gap);
+            out_.commit(p);
+            position_ += static_cast<std::uint64_t>(p - start);
+        }
+        ++index_.back().count;
+        previous_ = prime;
+        ++count_;
+    }
+
+    template <typename It>
+    void write(It first, It last) {
+        for (; first != last; ++first) write(*first);
+    }
+
+    // Appends the index and fills in the header.
+    void finish() {
+        std::uint64_t index_offset = position_;
+        for (PrimeArchiveIndexEntry entry : index_) {
+            entry.first_prime = to_little_endian(entry.first_prime);
+            entry.offset = to_little_endian(entry.offset);
+            entry.count = to_little_endian(entry.count);
+            char *p = out_.reserve(sizeof(entry));
+            std::memcpy(p, &entry, sizeof(entry));
+            out_.commit(p + sizeof(entry));
+        }
+        out_.flush();
+
+        PrimeArchiveHeader header{};
+        std::memcpy(header.magic, PRIME_ARCHIVE_MAGIC, sizeof(header.magic));
+        header.version = to_little_endian(PRIME_ARCHIVE_VERSION);
+        header.block_size = to_little_endian(block_size_);
+        header.a = to_little_endian(a_);
+        header.b = to_little_endian(b_);
+        header.count = to_little_endian(count_);
+        header.block_count = to_little_endian<std::uint64_t>(index_.size());
+        header.index_offset = to_little_endian(index_offset);
+        header_written_ =
+            ::pwrite(fd_, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    }
+
+    void flush() { out_.flush(); }
+    bool ok() const { return out_.ok() && header_written_; }
+
+   private:
+    int fd_;
+    OutputBuffer out_;
+    std::uint64_t a_;
+    std::uint64_t b_;
+    std::uint32_t block_size_;
+    std::vector<PrimeArchiveIndexEntry> index_;
+    std::uint64_t position_ = 0;
+    std::uint64_t previous_ = 0;
+    std::uint64_t count_ = 0;
+    bool header_written_ = true;
+};
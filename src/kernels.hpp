@@ -0,0 +1,513 @@
+#pragma once
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// Hot loops of the wheel sieve over raw bitmap bytes, in one version per instruction set:
+// popcount, expanding set bits into integers, and ANDing a repeating pattern into a segment
+// (which clears the multiples of a small prime in a few vector operations per segment). The
+// per-number engines get one more: trial division of a batch of candidates by the same small
+// primes, one vector lane per candidate.
+//
+// Every version is compiled for its own target with __attribute__((target)), so the build needs
+// no -m flags and a single binary runs on any x86-64 machine. sieve_kernel() is the best version
+// the CPU supports, checked once with CPUID; -kernel can force a specific one for testing.
+
+// Bit indices set in each byte value, in ascending order, padded with zeros.
+struct BitIndexTable {
+    std::uint8_t index[256][8];
+
+    constexpr BitIndexTable() : index() {
+        for (unsigned byte = 0; byte < 256; ++byte) {
+            unsigned n = 0;
+            for (unsigned k = 0; k < 8; ++k) {
+                if (byte & (1u << k)) index[byte][n++] = static_cast<std::uint8_t>(k);
+            }
+        }
+    }
+};
+inline constexpr BitIndexTable BIT_INDEX{};
+
+// Number of odd primes below 2^10, the divisors of trial_divide32() and of is_prime_small().
+constexpr std::size_t TRIAL_DIVISOR_COUNT = 171;
+
+// An odd prime with the constants that test divisibility by it without dividing: n < 2^32 is a
+// multiple of p exactly when n * p^-1 mod 2^32 <= (2^32 - 1) / p.
+struct TrialDivisor {
+    std::uint32_t prime, inverse, max;
+};
+
+// The odd primes below 2^10 in ascending order.
+struct TrialDivisorTable {
+    TrialDivisor divisor[TRIAL_DIVISOR_COUNT];
+
+    constexpr TrialDivisorTable() : divisor() {
+        std::size_t k = 0;
+        for (std::uint32_t p = 3; k < TRIAL_DIVISOR_COUNT; p += 2) {
+            bool prime = true;
+            for (std::uint32_t d = 3; d * d <= p; d += 2) prime = prime && p % d != 0;
+            if (!prime) continue;
+            std::uint32_t inverse = p;
+            for (int i = 0; i < 4; ++i) inverse *= 2 - p * inverse;  // Newton: 3 -> 48 bits
+            divisor[k++] = {p, inverse, UINT32_MAX / p};
+        }
+    }
+};
+inline constexpr TrialDivisorTable TRIAL_DIVISORS{};
+
+struct SieveKernel {
+    const char *name;
+
+    // Number of set bits in bits[0, bytes).
+    std::uint64_t (*popcount)(const std::uint8_t *bits, std::size_t bytes);
+
+    // Writes base + stride * i + lanes[k] for every set bit k of bits[i], in ascending order,
+    // and returns how many values were written. out must have room for 8 * bytes values, as the
+    // vector versions store whole lanes before advancing.
+    std::size_t (*expand32)(const std::uint8_t *bits, std::size_t bytes, std::uint32_t base,
+                            std::uint32_t stride, const std::uint8_t *lanes, std::uint32_t *out);
+    std::size_t (*expand64)(const std::uint8_t *bits, std::size_t bytes, std::uint64_t base,
+                            std::uint64_t stride, const std::uint8_t *lanes, std::uint64_t *out);
+
+    // bits[i] &= pattern[(phase + i) % period] for i in [0, bytes). pattern must hold 64 bytes
+    // past `period` that repeat its start, so that any 64 bytes from a phase < period can be
+    // loaded at once.
+    void (*and_pattern)(std::uint8_t *bits, std::size_t bytes, const std::uint8_t *pattern,
+                        std::size_t period, std::size_t phase);
+
+    // Clears keep[i] for every values[i] that is a multiple of one of the first `divisors` primes
+    // of TRIAL_DIVISORS. The values must be larger than those primes.
+    void (*trial_divide32)(const std::uint32_t *values, std::size_t count, std::size_t divisors,
+                           std::uint8_t *keep);
+
+    // Primes up to this are cheaper to clear with and_pattern() than to cross off one by one.
+    std::uint32_t pattern_limit;
+};
+
+// Bytes that and_pattern() may read past a pattern's period.
+constexpr std::size_t SIEVE_KERNEL_PATTERN_PADDING = 64;
+
+// Scalar versions, the reference for the others.
+
+inline std::uint64_t popcount_scalar(const std::uint8_t *bits, std::size_t bytes) {
+    std::uint64_t total = 0;
+    std::size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bits + i, sizeof(word));
+        total += __builtin_popcountll(word);
+    }
+    for (; i < bytes; ++i) total += __builtin_popcount(bits[i]);
+    return total;
+}
+
+template <typename T>
+std::size_t expand_scalar(const std::uint8_t *bits, std::size_t bytes, T base, T stride,
+                          const std::uint8_t *lanes, T *out) {
+    T *start = out;
+    for (std::size_t i = 0; i < bytes; ++i, base += stride) {
+        for (unsigned byte = bits[i]; byte; byte &= byte - 1) {
+            *out++ = base + lanes[__builtin_ctz(byte)];
+        }
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+// The 8-byte words of the segment are ANDed with the pattern at the current phase, which then
+// advances by 8 mod period; the vector versions do the same with wider blocks.
+inline void and_pattern_scalar(std::uint8_t *bits, std::size_t bytes, const std::uint8_t *pattern,
+                               std::size_t period, std::size_t phase) {
+    std::size_t step = 8 % period;
+    std::size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        std::uint64_t word, mask;
+        std::memcpy(&word, bits + i, sizeof(word));
+        std::memcpy(&mask, pattern + phase, sizeof(mask));
+        word &= mask;
+        std::memcpy(bits + i, &word, sizeof(word));
+        phase += step;
+        if (phase >= period) phase -= period;
+    }
+    for (; i < bytes; ++i) {
+        bits[i] &= pattern[phase];
+        if (++phase == period) phase = 0;
+    }
+}
+
+// One candidate at a time, stopping at its first divisor.
+inline void trial_divide32_scalar(const std::uint32_t *values, std::size_t count,
+                                  std::size_t divisors, std::uint8_t *keep) {
+    for (std::size_t i = 0; i < count; ++i) {
+        for (std::size_t d = 0; d < divisors && keep[i]; ++d) {
+            const TrialDivisor &t = TRIAL_DIVISORS.divisor[d];
+            if (values[i] * t.inverse <= t.max) keep[i] = 0;
+        }
+    }
+}
+
+#if defined(__x86_64__)
+
+// SSE4.2 (with POPCNT): hardware popcount, and expansion through the bit index table and a
+// byte shuffle, which turns a byte into its (up to eight) values with no branches.
+
+__attribute__((target("sse4.2,popcnt"))) inline std::uint64_t popcount_sse42(
+    const std::uint8_t *bits, std::size_t bytes) {
+    std::uint64_t total = 0;
+    std::size_t i = 0;
+    for (; i + 8 <= bytes; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bits + i, sizeof(word));
+        total += static_cast<std::uint64_t>(_mm_popcnt_u64(word));
+    }
+    for (; i < bytes; ++i) total += static_cast<std::uint64_t>(_mm_popcnt_u32(bits[i]));
+    return total;
+}
+
+__attribute__((target("sse4.2,popcnt"))) inline std::size_t expand32_sse42(
+    const std::uint8_t *bits, std::size_t bytes, std::uint32_t base, std::uint32_t stride,
+    const std::uint8_t *lanes, std::uint32_t *out) {
+    std::uint32_t *start = out;
+    __m128i lane_bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes));
+    __m128i offset = _mm_set1_epi32(static_cast<int>(base));
+    __m128i step = _mm_set1_epi32(static_cast<int>(stride));
+    for (std::size_t i = 0; i < bytes; ++i) {
+        unsigned byte = bits[i];
+        __m128i index = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(BIT_INDEX.index[byte]));
+        __m128i values = _mm_shuffle_epi8(lane_bytes, index);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out),
+                         _mm_add_epi32(offset, _mm_cvtepu8_epi32(values)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 4),
+                         _mm_add_epi32(offset, _mm_cvtepu8_epi32(_mm_srli_si128(values, 4))));
+        out += _mm_popcnt_u32(byte);
+        offset = _mm_add_epi32(offset, step);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+__attribute__((target("sse4.2,popcnt"))) inline std::size_t expand64_sse42(
+    const std::uint8_t *bits, std::size_t bytes, std::uint64_t base, std::uint64_t stride,
+    const std::uint8_t *lanes, std::uint64_t *out) {
+    std::uint64_t *start = out;
+    __m128i lane_bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes));
+    __m128i offset = _mm_set1_epi64x(static_cast<long long>(base));
+    __m128i step = _mm_set1_epi64x(static_cast<long long>(stride));
+    for (std::size_t i = 0; i < bytes; ++i) {
+        unsigned byte = bits[i];
+        __m128i index = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(BIT_INDEX.index[byte]));
+        __m128i values = _mm_shuffle_epi8(lane_bytes, index);
+        for (int pair = 0; pair < 4; ++pair) {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 2 * pair),
+                             _mm_add_epi64(offset, _mm_cvtepu8_epi64(values)));
+            values = _mm_srli_si128(values, 2);
+        }
+        out += _mm_popcnt_u32(byte);
+        offset = _mm_add_epi64(offset, step);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+__attribute__((target("sse4.2,popcnt"))) inline void and_pattern_sse42(
+    std::uint8_t *bits, std::size_t bytes, const std::uint8_t *pattern, std::size_t period,
+    std::size_t phase) {
+    std::size_t step = 16 % period;
+    std::size_t i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i *block = reinterpret_cast<__m128i *>(bits + i);
+        __m128i mask = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pattern + phase));
+        _mm_storeu_si128(block, _mm_and_si128(_mm_loadu_si128(block), mask));
+        phase += step;
+        if (phase >= period) phase -= period;
+    }
+    and_pattern_scalar(bits + i, bytes - i, pattern, period, phase);
+}
+
+// Four candidates per vector; unsigned a <= b is tested as a == min(a, b).
+__attribute__((target("sse4.2,popcnt"))) inline void trial_divide32_sse42(
+    const std::uint32_t *values, std::size_t count, std::size_t divisors, std::uint8_t *keep) {
+    std::size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(values + i));
+        __m128i struck = _mm_setzero_si128();
+        for (std::size_t d = 0; d < divisors; ++d) {
+            const TrialDivisor &t = TRIAL_DIVISORS.divisor[d];
+            __m128i product = _mm_mullo_epi32(v, _mm_set1_epi32(static_cast<int>(t.inverse)));
+            __m128i max = _mm_set1_epi32(static_cast<int>(t.max));
+            struck = _mm_or_si128(struck, _mm_cmpeq_epi32(_mm_min_epu32(product, max), product));
+        }
+        unsigned mask = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(struck)));
+        for (int k = 0; k < 4; ++k) keep[i + k] &= (mask >> k & 1) ^ 1;
+    }
+    trial_divide32_scalar(values + i, count - i, divisors, keep + i);
+}
+
+// AVX2: 32-byte popcount by nibble lookup (pshufb) summed with psadbw, eight 32-bit values per
+// expanded byte in one store, 32-byte pattern blocks.
+
+__attribute__((target("avx2,popcnt"))) inline std::uint64_t popcount_avx2(
+    const std::uint8_t *bits, std::size_t bytes) {
+    const __m256i nibble_counts =
+        _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+    __m256i sums = _mm256_setzero_si256();
+    std::size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bits + i));
+        __m256i counts = _mm256_add_epi8(
+            _mm256_shuffle_epi8(nibble_counts, _mm256_and_si256(v, low_nibbles)),
+            _mm256_shuffle_epi8(nibble_counts,
+                                _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles)));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    std::uint64_t total = static_cast<std::uint64_t>(_mm256_extract_epi64(sums, 0)) +
+                          static_cast<std::uint64_t>(_mm256_extract_epi64(sums, 1)) +
+                          static_cast<std::uint64_t>(_mm256_extract_epi64(sums, 2)) +
+                          static_cast<std::uint64_t>(_mm256_extract_epi64(sums, 3));
+    for (; i + 8 <= bytes; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bits + i, sizeof(word));
+        total += static_cast<std::uint64_t>(_mm_popcnt_u64(word));
+    }
+    for (; i < bytes; ++i) total += static_cast<std::uint64_t>(_mm_popcnt_u32(bits[i]));
+    return total;
+}
+
+__attribute__((target("avx2,popcnt"))) inline std::size_t expand32_avx2(
+    const std::uint8_t *bits, std::size_t bytes, std::uint32_t base, std::uint32_t stride,
+    const std::uint8_t *lanes, std::uint32_t *out) {
+    std::uint32_t *start = out;
+    __m128i lane_bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes));
+    __m256i offset = _mm256_set1_epi32(static_cast<int>(base));
+    __m256i step = _mm256_set1_epi32(static_cast<int>(stride));
+    for (std::size_t i = 0; i < bytes; ++i) {
+        unsigned byte = bits[i];
+        __m128i index = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(BIT_INDEX.index[byte]));
+        __m256i values = _mm256_cvtepu8_epi32(_mm_shuffle_epi8(lane_bytes, index));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out), _mm256_add_epi32(offset, values));
+        out += _mm_popcnt_u32(byte);
+        offset = _mm256_add_epi32(offset, step);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+__attribute__((target("avx2,popcnt"))) inline std::size_t expand64_avx2(
+    const std::uint8_t *bits, std::size_t bytes, std::uint64_t base, std::uint64_t stride,
+    const std::uint8_t *lanes, std::uint64_t *out) {
+    std::uint64_t *start = out;
+    __m128i lane_bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes));
+    __m256i offset = _mm256_set1_epi64x(static_cast<long long>(base));
+    __m256i step = _mm256_set1_epi64x(static_cast<long long>(stride));
+    for (std::size_t i = 0; i < bytes; ++i) {
+        unsigned byte = bits[i];
+        __m128i index = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(BIT_INDEX.index[byte]));
+        __m128i values = _mm_shuffle_epi8(lane_bytes, index);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out),
+                            _mm256_add_epi64(offset, _mm256_cvtepu8_epi64(values)));
+        __m256i high = _mm256_cvtepu8_epi64(_mm_srli_si128(values, 4));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + 4), _mm256_add_epi64(offset, high));
+        out += _mm_popcnt_u32(byte);
+        offset = _mm256_add_epi64(offset, step);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+__attribute__((target("avx2,popcnt"))) inline void and_pattern_avx2(
+    std::uint8_t *bits, std::size_t bytes, const std::uint8_t *pattern, std::size_t period,
+    std::size_t phase) {
+    std::size_t step = 32 % period;
+    std::size_t i = 0;
+    for (; i + 32 <= bytes; i += 32) {
+        __m256i *block = reinterpret_cast<__m256i *>(bits + i);
+        __m256i mask = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(pattern + phase));
+        _mm256_storeu_si256(block, _mm256_and_si256(_mm256_loadu_si256(block), mask));
+        phase += step;
+        if (phase >= period) phase -= period;
+    }
+    and_pattern_scalar(bits + i, bytes - i, pattern, period, phase);
+}
+
+__attribute__((target("avx2,popcnt"))) inline void trial_divide32_avx2(
+    const std::uint32_t *values, std::size_t count, std::size_t divisors, std::uint8_t *keep) {
+    std::size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(values + i));
+        __m256i struck = _mm256_setzero_si256();
+        for (std::size_t d = 0; d < divisors; ++d) {
+            const TrialDivisor &t = TRIAL_DIVISORS.divisor[d];
+            __m256i product =
+                _mm256_mullo_epi32(v, _mm256_set1_epi32(static_cast<int>(t.inverse)));
+            __m256i max = _mm256_set1_epi32(static_cast<int>(t.max));
+            struck = _mm256_or_si256(struck,
+                                     _mm256_cmpeq_epi32(_mm256_min_epu32(product, max), product));
+        }
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(struck)));
+        for (int k = 0; k < 8; ++k) keep[i + k] &= (mask >> k & 1) ^ 1;
+    }
+    trial_divide32_scalar(values + i, count - i, divisors, keep + i);
+}
+
+// AVX-512 (F, BW, VL and VPOPCNTDQ): vpopcntq over 64-byte blocks, expansion by compress
+// stores, where the bitmap byte itself is the lane mask, and trial division of 16 candidates at
+// once with unsigned compares into a mask register.
+
+#define SIEVE_KERNEL_AVX512 "avx512f,avx512bw,avx512vl,avx512vpopcntdq,popcnt"
+
+__attribute__((target(SIEVE_KERNEL_AVX512))) inline std::uint64_t popcount_avx512(
+    const std::uint8_t *bits, std::size_t bytes) {
+    __m512i sums = _mm512_setzero_si512();
+    std::size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        sums = _mm512_add_epi64(sums, _mm512_popcnt_epi64(_mm512_loadu_si512(bits + i)));
+    }
+    std::uint64_t lanes[8];
+    _mm512_storeu_si512(lanes, sums);
+    std::uint64_t total = 0;
+    for (std::uint64_t lane : lanes) total += lane;
+    for (; i + 8 <= bytes; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, bits + i, sizeof(word));
+        total += static_cast<std::uint64_t>(_mm_popcnt_u64(word));
+    }
+    for (; i < bytes; ++i) total += static_cast<std::uint64_t>(_mm_popcnt_u32(bits[i]));
+    return total;
+}
+
+__attribute__((target(SIEVE_KERNEL_AVX512))) inline std::size_t expand32_avx512(
+    const std::uint8_t *bits, std::size_t bytes, std::uint32_t base, std::uint32_t stride,
+    const std::uint8_t *lanes, std::uint32_t *out) {
+    std::uint32_t *start = out;
+    // Two bytes per step: lanes 0-7 for the first, 8-15 (one stride further) for the second.
+    __m512i lane_values = _mm512_add_epi32(
+        _mm512_maskz_cvtepu8_epi32(0xffff, _mm_unpacklo_epi64(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes)),
+            _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes)))),
+        _mm512_mask_set1_epi32(_mm512_setzero_si512(), 0xff00, static_cast<int>(stride)));
+    __m512i offset = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int>(base)), lane_values);
+    __m512i step = _mm512_set1_epi32(static_cast<int>(2 * stride));
+    std::size_t i = 0;
+    for (; i + 2 <= bytes; i += 2) {
+        std::uint16_t mask;
+        std::memcpy(&mask, bits + i, sizeof(mask));
+        _mm512_mask_compressstoreu_epi32(out, mask, offset);
+        out += _mm_popcnt_u32(mask);
+        offset = _mm512_add_epi32(offset, step);
+    }
+    if (i < bytes) {
+        _mm512_mask_compressstoreu_epi32(out, bits[i], offset);
+        out += _mm_popcnt_u32(bits[i]);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+__attribute__((target(SIEVE_KERNEL_AVX512))) inline std::size_t expand64_avx512(
+    const std::uint8_t *bits, std::size_t bytes, std::uint64_t base, std::uint64_t stride,
+    const std::uint8_t *lanes, std::uint64_t *out) {
+    std::uint64_t *start = out;
+    __m128i lane_bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(lanes));
+    __m512i offset = _mm512_add_epi64(_mm512_set1_epi64(static_cast<long long>(base)),
+                                      _mm512_maskz_cvtepu8_epi64(0xff, lane_bytes));
+    __m512i step = _mm512_set1_epi64(static_cast<long long>(stride));
+    for (std::size_t i = 0; i < bytes; ++i) {
+        _mm512_mask_compressstoreu_epi64(out, bits[i], offset);
+        out += _mm_popcnt_u32(bits[i]);
+        offset = _mm512_add_epi64(offset, step);
+    }
+    return static_cast<std::size_t>(out - start);
+}
+
+__attribute__((target(SIEVE_KERNEL_AVX512))) inline void and_pattern_avx512(
+    std::uint8_t *bits, std::size_t bytes, const std::uint8_t *pattern, std::size_t period,
+    std::size_t phase) {
+    std::size_t step = 64 % period;
+    std::size_t i = 0;
+    for (; i + 64 <= bytes; i += 64) {
+        _mm512_storeu_si512(bits + i, _mm512_and_si512(_mm512_loadu_si512(bits + i),
+                                                       _mm512_loadu_si512(pattern + phase)));
+        phase += step;
+        if (phase >= period) phase -= period;
+    }
+    and_pattern_scalar(bits + i, bytes - i, pattern, period, phase);
+}
+
+__attribute__((target(SIEVE_KERNEL_AVX512))) inline void trial_divide32_avx512(
+    const std::uint32_t *values, std::size_t count, std::size_t divisors, std::uint8_t *keep) {
+    std::size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512(values + i);
+        __mmask16 struck = 0;
+        for (std::size_t d = 0; d < divisors; ++d) {
+            const TrialDivisor &t = TRIAL_DIVISORS.divisor[d];
+            __m512i product =
+                _mm512_mullo_epi32(v, _mm512_set1_epi32(static_cast<int>(t.inverse)));
+            struck |= _mm512_cmple_epu32_mask(product,
+                                              _mm512_set1_epi32(static_cast<int>(t.max)));
+        }
+        for (int k = 0; k < 16; ++k) keep[i + k] &= (struck >> k & 1) ^ 1;
+    }
+    trial_divide32_scalar(values + i, count - i, divisors, keep + i);
+}
+
+#endif  // __x86_64__
+
+// Ordered from least to most capable.
+inline const SieveKernel SIEVE_KERNELS[] = {
+    {"scalar", popcount_scalar, expand_scalar<std::uint32_t>, expand_scalar<std::uint64_t>,
+     and_pattern_scalar, trial_divide32_scalar, 31},
+#if defined(__x86_64__)
+    {"sse4.2", popcount_sse42, expand32_sse42, expand64_sse42, and_pattern_sse42,
+     trial_divide32_sse42, 251},
+    {"avx2", popcount_avx2, expand32_avx2, expand64_avx2, and_pattern_avx2, trial_divide32_avx2,
+     509},
+    {"avx512", popcount_avx512, expand32_avx512, expand64_avx512, and_pattern_avx512,
+     trial_divide32_avx512, 509},
+#endif
+};
+
+// Whether the CPU can run the kernel.
+inline bool sieve_kernel_supported(const SieveKernel &kernel) {
+#if defined(__x86_64__)
+    std::string name = kernel.name;
+    if (name == "sse4.2") {
+        return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt");
+    }
+    if (name == "avx2") return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+    if (name == "avx512") {
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512vpopcntdq");
+    }
+#endif
+    (void)kernel;
+    return true;
+}
+
+inline const SieveKernel *&active_sieve_kernel() {
+    static const SieveKernel *kernel = [] {
+        const SieveKernel *best = &SIEVE_KERNELS[0];
+        for (const SieveKernel &k : SIEVE_KERNELS) {
+            if (sieve_kernel_supported(k)) best = &k;
+        }
+        return best;
+    }();
+    return kernel;
+}
+
+// The kernel the sieve runs with: the most capable one the CPU supports unless forced.
+inline const SieveKernel &sieve_kernel() { return *active_sieve_kernel(); }
+
+// Makes every later sieve use the named kernel. False if there is no such kernel or the CPU
+// cannot run it. Must be called before any sieving starts.
+inline bool force_sieve_kernel(const std::string &name) {
+    for (const SieveKernel &k : SIEVE_KERNELS) {
+        if (name == k.name && sieve_kernel_supported(k)) {
+            active_sieve_kernel() = &k;
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,73 +1,160 @@
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cerrno>
 #include <chrono>
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <sstream>
 #include <thread>
 #include <vector>
 
 #include "../include/argparse.hpp"
+#include "cache.hpp"
+#include "candidates.hpp"
+#include "format.hpp"
+#include "prime_count.hpp"
+#include "primality.hpp"
+#include "scheduler.hpp"
+#include "server.hpp"
+#include "sieve.hpp"
+#include "topology.hpp"
+
+enum class Engine { automatic, sieve, trial, mr32 };
+enum class OutputFormat { text, bin, gaps };
 
-std::vector<int> primes;
-std::mutex primes_mutex;
-std::vector<std::pair<std::thread::id, double>>
-    thread_times;  // To store thread id and the time it took
-std::mutex times_mutex;
+// Primes found by each task, indexed by task number. Tasks cover disjoint, increasing parts of
+// [a, b], so walking the slots in order (or in reverse) yields sorted output without a sort or a
+// shared lock. Instantiated for uint32_t when b fits, uint64_t otherwise.
+template <typename T>
+std::vector<std::vector<T>> chunk_primes;
 bool sort_ascending = true;  // Default sort order
 bool hush = false;           // Suppress thread finishing status
 int columns = 1;             // Number of columns for output
+Engine engine = Engine::automatic;
+bool auto_prime_pi = false;  // -engine auto: count with LMO pi(x) where that beats sieving
+bool count_only = false;  // Report how many primes there are instead of listing them
+uint64_t nth_index = 0;   // -nth: report only the nth_index-th prime of [a, b]
+uint64_t next_count = 0;  // -next: list only the first next_count primes of [a, b]
+constexpr uint64_t TASKS_PER_THREAD = 16;  // Work units handed to the scheduler per worker
+constexpr uint64_t MIN_TASK_SIZE = 1 << 16;  // Smallest range worth scheduling on its own
+constexpr uint64_t STREAM_TASK_SIZE = 1 << 22;  // Fixed task size for --stream, bounds each chunk
+constexpr std::size_t STREAM_WINDOW_PER_THREAD = 4;  // Chunks in flight per worker for --stream
+constexpr std::size_t TEST_BATCH_SIZE = 1 << 10;  // Odd numbers per test_batch() call
+bool stream = false;  // Emit chunks in order as soon as they are ready
+OutputFormat output_format = OutputFormat::text;
+std::vector<uint32_t> base_primes;  // Primes up to sqrt(b), shared read-only by the sieve engine
+uint64_t base_primes_reach = 0;     // base_primes holds every prime up to this
+std::unique_ptr<SieveCache> sieve_cache;  // -cache, consulted by the sieve engine
+std::vector<int> worker_cpus;  // -affinity: CPU of each worker, empty to leave placement to the OS
+constexpr uint64_t SERVE_PARALLEL_SIZE = 1 << 22;  // Wider -serve queries go to the pool
+constexpr uint64_t SERVE_MAX_RANGE = 1 << 30;  // Widest `range` query, bounds the reply size
 
-bool is_prime(int n) {
-    if (n <= 1) return false;
-    if (n <= 3) return true;
-    if (n % 2 == 0 || n % 3 == 0) return false;
-    for (int i = 5; i * i <= n; i += 6) {
-        if (n % i == 0 || n % (i + 2) == 0) return false;
-    }
-    return true;
+// Per-number test of the trial and mr32 engines; mr32 falls back to is_prime() above 2^32.
+template <typename T>
+bool test_prime(T n) {
+    if (engine == Engine::mr32 && n <= UINT32_MAX) return is_prime_mr32(static_cast<uint32_t>(n));
+    return is_prime(n);
 }
 
-void find_primes(int start, int end) {
-    auto start_time = std::chrono::high_resolution_clock::now();
-    std::vector<int> local_primes;
-
-    for (int i = start; i <= end; ++i) {
-        if (is_prime(i)) {
-            local_primes.push_back(i);
+// Calls on_prime for each prime in [start, end] in ascending order: 2, then the odd numbers in
+// batches through test_batch().
+template <typename T, typename OnPrime>
+void test_range(T start, T end, OnPrime on_prime) {
+    if (start <= 2 && end >= 2) on_prime(T(2));
+    T values[TEST_BATCH_SIZE];
+    uint8_t prime[TEST_BATCH_SIZE];
+    T n = start | 1;
+    bool done = n > end;
+    while (!done) {
+        std::size_t count = 0;
+        while (count < TEST_BATCH_SIZE && !done) {
+            values[count++] = n;
+            done = end - n < 2;
+            n += 2;
+        }
+        test_batch(values, count, prime, [](T v) { return test_prime(v); });
+        for (std::size_t i = 0; i < count; ++i) {
+            if (prime[i]) on_prime(values[i]);
         }
     }
+}
 
-    {
-        std::lock_guard<std::mutex> lock(primes_mutex);
-        primes.insert(primes.end(), local_primes.begin(), local_primes.end());
+template <typename T>
+void find_primes(T start, T end, std::vector<T> &local_primes) {
+    if (engine == Engine::sieve && sieve_cache) {
+        primes_from_segments(start, end, [&](auto on_view) {
+            sieve_cache->for_each_segment(start, end, base_primes, on_view);
+        }, local_primes);
+    } else if (engine == Engine::sieve) {
+        segmented_sieve(start, end, base_primes, local_primes);
+    } else {
+        test_range(start, end, [&](T prime) { local_primes.push_back(prime); });
     }
+}
 
-    auto end_time = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double, std::milli> elapsed = end_time - start_time;
-
-    {
-        std::lock_guard<std::mutex> lock(times_mutex);
-        thread_times.emplace_back(std::this_thread::get_id(), elapsed.count());
+// Number of primes in [start, end]; never materializes the primes themselves.
+template <typename T>
+uint64_t count_primes(T start, T end) {
+    if (engine == Engine::sieve && sieve_cache) {
+        return count_from_segments(start, end, [&](auto on_view) {
+            sieve_cache->for_each_segment(start, end, base_primes, on_view);
+        });
+    }
+    if (engine == Engine::sieve) {
+        return segmented_count(start, end, base_primes);
     }
+    uint64_t count = 0;
+    test_range(start, end, [&](T) { ++count; });
+    return count;
 }
 
-void parse_arguments(int argc, char *argv[], int &a, int &b, std::string &filename, int &threads,
-                     bool &output_to_file, bool &sort_ascending, bool &hush, int &columns) {
+// Extends base_primes, if needed, so that the sieve engine can sieve up to hi. Callers that find
+// out how far they go as they sieve get an eighth of headroom, so they regenerate rarely.
+void reach_base_primes(uint64_t hi) {
+    if (engine != Engine::sieve) return;
+    uint64_t needed = isqrt(sieve_cache ? SieveCache::sieve_limit(hi) : hi);
+    if (needed <= base_primes_reach) return;
+    base_primes_reach = std::min<uint64_t>(needed + needed / 8, UINT32_MAX);
+    base_primes = generate_primes(static_cast<uint32_t>(base_primes_reach));
+}
+
+void parse_arguments(int argc, char *argv[], uint64_t &a, uint64_t &b, std::string &filename,
+                     int &threads,
+                     bool &output_to_file, bool &sort_ascending, bool &hush, int &columns,
+                     Engine &engine, bool &count_only, bool &stream,
+                     OutputFormat &output_format, std::string &cache_dir,
+                     uint64_t &cache_size_mib, std::string &socket_path, uint64_t &nth_index,
+                     uint64_t &next_count, std::string &kernel_name,
+                     uint64_t &segment_kib, Affinity &affinity, bool &physical_cores,
+                     std::string &input_path, InputFormat &input_format, bool &bitmap) {
     argparse::ArgumentParser program("prime_finder");
 
     program.add_argument("a")
-        .help("Start of the range (must be a positive integer)")
-        .scan<'i', int>();
+        .help("Start of the range (must be a positive integer; omitted with -input)")
+        .nargs(argparse::nargs_pattern::optional)
+        .default_value(uint64_t(0))
+        .scan<'u', uint64_t>();
     program.add_argument("b")
-        .help("End of the range (must be a positive integer greater than a)")
-        .scan<'i', int>();
+        .help("End of the range (must be a positive integer greater than a, up to 2^64 - 1; "
+              "omitted with -input)")
+        .nargs(argparse::nargs_pattern::optional)
+        .default_value(uint64_t(0))
+        .scan<'u', uint64_t>();
 
     program.add_argument("-file")
         .help("Output primes to FILE instead of the console")
-        .default_value(std::string(""))
-        .implicit_value(std::string(""));
+        .default_value(std::string(""));
 
     program.add_argument("-threads")
         .help("Number of threads to use (default: 4)")
@@ -95,6 +182,124 @@ void parse_arguments(int argc, char *argv[], int &a, int &b, std::string &filena
         .default_value(1)
         .scan<'i', int>();
 
+    program.add_argument("-engine")
+        .help("Prime finding engine: 'sieve' (segmented sieve), 'trial' (tests each number: "
+              "trial division below 2^19, Miller-Rabin above), 'mr32' (like 'trial', but one "
+              "hashed-base Miller-Rabin round per number below 2^32) or 'auto' (default, sieve "
+              "unless [a, b] is narrower than sqrt(b) / 64, LMO pi(x) for wide counts)")
+        .default_value(std::string("auto"))
+        .action([](const std::string &value) {
+            static const std::vector<std::string> choices = {"auto", "sieve", "trial", "mr32"};
+            if (std::find(choices.begin(), choices.end(), value) != choices.end()) {
+                return value;
+            }
+            return std::string("auto");
+        });
+
+    program.add_argument("--count")
+        .help("Only count the primes in [a, b]; with -file the count is written there as JSON")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("--stream")
+        .help("Write primes in order as soon as each chunk is ready, with bounded memory")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("-format")
+        .help("Output format: 'text' (default), 'bin' (header plus raw little-endian primes; see "
+              "include/prime_reader.hpp) or 'gaps' (compressed archive, always ascending; see "
+              "include/prime_archive.hpp). 'bin' and 'gaps' need -file")
+        .default_value(std::string("text"))
+        .action([](const std::string &value) {
+            static const std::vector<std::string> choices = {"text", "bin", "gaps"};
+            if (std::find(choices.begin(), choices.end(), value) != choices.end()) {
+                return value;
+            }
+            return std::string("text");
+        });
+
+    program.add_argument("-cache")
+        .help("Directory of sieved blocks reused across runs; only the uncached parts of [a, b] "
+              "are sieved (sieve engine only)")
+        .default_value(std::string(""));
+
+    program.add_argument("-cache-size")
+        .help("Size cap of the -cache directory in MiB (default: 1024)")
+        .default_value(uint64_t(1024))
+        .scan<'u', uint64_t>();
+
+    program.add_argument("-serve")
+        .help("Answer range, count, is_prime, next and prev queries within [a, b] on this Unix "
+              "socket instead of running once")
+        .default_value(std::string(""));
+
+    program.add_argument("-nth")
+        .help("Only report the K-th prime of [a, b], counting from 1: a pi(x) estimate jumps close "
+              "to it and only the primes around the estimate are sieved")
+        .default_value(uint64_t(0))
+        .scan<'u', uint64_t>();
+
+    program.add_argument("-next")
+        .help("Only list the first N primes of [a, b], sieving upwards from a in windows sized "
+              "for the primes still missing")
+        .default_value(uint64_t(0))
+        .scan<'u', uint64_t>();
+
+    program.add_argument("-kernel")
+        .help("Vector kernel of the sieve and of batched trial division: 'scalar', 'sse4.2', "
+              "'avx2', 'avx512' or 'auto' (default, the best one this CPU supports)")
+        .default_value(std::string("auto"));
+
+    program.add_argument("-affinity")
+        .help("Worker placement: 'compact' (fill the SMT siblings and cores of one node first), "
+              "'scatter' (spread over physical cores and nodes first) or 'none' (default, left "
+              "to the OS)")
+        .default_value(std::string("none"))
+        .action([](const std::string &value) {
+            static const std::vector<std::string> choices = {"none", "compact", "scatter"};
+            if (std::find(choices.begin(), choices.end(), value) != choices.end()) {
+                return value;
+            }
+            return std::string("none");
+        });
+
+    program.add_argument("--physical-cores")
+        .help("One worker per physical core: -affinity leaves all SMT siblings but the first "
+              "idle, and -threads defaults to the number of physical cores")
+        .default_value(false)
+        .implicit_value(true);
+
+    program.add_argument("-segment-size")
+        .help("Sieve segment size in KiB (default: 0, a quarter of the L2 size read from sysconf "
+              "or /sys/devices/system/cpu)")
+        .default_value(uint64_t(0))
+        .scan<'u', uint64_t>();
+
+    program.add_argument("-input")
+        .help("Test the candidates in FILE ('-' for stdin) instead of [a, b] and write the primes "
+              "among them in input order, using the fastest exact test for each size whatever "
+              "-engine says")
+        .default_value(std::string(""));
+
+    program.add_argument("-input-format")
+        .help("-input layout: 'text' (default, decimal numbers separated by whitespace) or 'bin' "
+              "(raw little-endian 64-bit integers)")
+        .default_value(std::string("text"))
+        .action([](const std::string &value) {
+            static const std::vector<std::string> choices = {"text", "bin"};
+            if (std::find(choices.begin(), choices.end(), value) != choices.end()) {
+                return value;
+            }
+            return std::string("text");
+        });
+
+    program.add_argument("--bitmap")
+        .help("With -input, write one bit per candidate (1 for a prime, least significant bit "
+              "first) instead of the primes")
+        .default_value(false)
+        .implicit_value(true);
+
     try {
         program.parse_args(argc, argv);
     } catch (const std::runtime_error &err) {
@@ -103,28 +308,751 @@ void parse_arguments(int argc, char *argv[], int &a, int &b, std::string &filena
         exit(1);
     }
 
-    a = program.get<int>("a");
-    b = program.get<int>("b");
+    a = program.get<uint64_t>("a");
+    b = program.get<uint64_t>("b");
     filename = program.get<std::string>("-file");
     threads = program.get<int>("-threads");
     sort_ascending = program.get<std::string>("-sort") == "asc";
     hush = program.get<bool>("--hush");
     columns = program.get<int>("-columns");
+    count_only = program.get<bool>("--count");
+    stream = program.get<bool>("--stream");
+    std::string format_name = program.get<std::string>("-format");
+    output_format = format_name == "bin"    ? OutputFormat::bin
+                    : format_name == "gaps" ? OutputFormat::gaps
+                                            : OutputFormat::text;
+
+    cache_dir = program.get<std::string>("-cache");
+    cache_size_mib = program.get<uint64_t>("-cache-size");
+    socket_path = program.get<std::string>("-serve");
+    nth_index = program.get<uint64_t>("-nth");
+    next_count = program.get<uint64_t>("-next");
+    kernel_name = program.get<std::string>("-kernel");
+    segment_kib = program.get<uint64_t>("-segment-size");
+    std::string affinity_name = program.get<std::string>("-affinity");
+    affinity = affinity_name == "compact"   ? Affinity::compact
+               : affinity_name == "scatter" ? Affinity::scatter
+                                            : Affinity::none;
+    physical_cores = program.get<bool>("--physical-cores");
+    input_path = program.get<std::string>("-input");
+    input_format = program.get<std::string>("-input-format") == "bin" ? InputFormat::bin
+                                                                       : InputFormat::text;
+    bitmap = program.get<bool>("--bitmap");
+    if (physical_cores && !program.is_used("-threads")) {
+        threads = std::max(1, physical_core_count());
+    }
+
+    std::string engine_name = program.get<std::string>("-engine");
+    engine = engine_name == "sieve"   ? Engine::sieve
+             : engine_name == "trial" ? Engine::trial
+             : engine_name == "mr32"  ? Engine::mr32
+                                      : Engine::automatic;
 
     output_to_file = !filename.empty();
 }
 
-void print_primes(const std::vector<int> &primes, int columns) {
-    int count = 0;
-    for (const auto &prime : primes) {
-        std::cout << prime << "\t";
-        if (++count % columns == 0) {
-            std::cout << std::endl;
+// Writes one chunk's primes, walking it backwards for descending output.
+template <typename Writer, typename T>
+void write_chunk(Writer &writer, const std::vector<T> &chunk, bool ascending) {
+    if (ascending) {
+        writer.write(chunk.begin(), chunk.end());
+    } else {
+        writer.write(chunk.rbegin(), chunk.rend());
+    }
+}
+
+// Writes the chunk slots in ascending or descending order.
+template <typename T, typename Writer>
+void print_primes(const std::vector<std::vector<T>> &chunks, bool ascending, Writer &writer) {
+    if (ascending) {
+        for (const auto &chunk : chunks) write_chunk(writer, chunk, true);
+    } else {
+        for (auto chunk = chunks.rbegin(); chunk != chunks.rend(); ++chunk) {
+            write_chunk(writer, *chunk, false);
+        }
+    }
+    writer.finish();
+}
+
+// -file output: a chunk's size follows from its prime count (and, for text, its digit lengths and
+// position in the row layout), so every chunk's file offset is a prefix sum computed up front. The
+// workers then format their chunks and pwrite() them into place in parallel.
+template <typename T>
+bool write_primes_parallel(WorkStealingPool &pool, const std::vector<std::vector<T>> &chunks,
+                           bool ascending, int fd, T a, T b) {
+    std::size_t n = chunks.size();
+    auto chunk_at = [&](std::size_t k) -> const std::vector<T> & {
+        return ascending ? chunks[k] : chunks[n - 1 - k];
+    };
+
+    std::vector<uint64_t> first_index(n);
+    uint64_t total = 0;
+    for (std::size_t k = 0; k < n; ++k) {
+        first_index[k] = total;
+        total += chunk_at(k).size();
+    }
+
+    std::atomic<bool> ok{true};
+    if (output_format == OutputFormat::bin) {
+        PrimeFileHeader header = make_prime_file_header<T>(a, b, total, !ascending);
+        if (ftruncate(fd, static_cast<off_t>(sizeof(header) + total * sizeof(T))) != 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))) {
+            return false;
         }
+        pool.run(n, [&](std::size_t k, int) {
+            BinaryWriter writer(fd, static_cast<off_t>(sizeof(header) + first_index[k] * sizeof(T)),
+                                chunk_at(k).size() * sizeof(T));
+            write_chunk(writer, chunk_at(k), ascending);
+            writer.flush();
+            if (!writer.ok()) ok = false;
+        });
+        return ok;
     }
-    if (count % columns != 0) {
-        std::cout << std::endl;
+
+    std::vector<uint64_t> offset(n + 1);
+    pool.run(n, [&](std::size_t k, int) {
+        offset[k + 1] = formatted_length(chunk_at(k), first_index[k], columns);
+    });
+    for (std::size_t k = 0; k < n; ++k) offset[k + 1] += offset[k];
+
+    bool partial_row = total % columns != 0;
+    if (ftruncate(fd, static_cast<off_t>(offset[n] + partial_row)) != 0) return false;
+
+    pool.run(n, [&](std::size_t k, int) {
+        TextWriter writer(fd, columns, first_index[k], static_cast<off_t>(offset[k]),
+                          offset[k + 1] - offset[k]);
+        write_chunk(writer, chunk_at(k), ascending);
+        writer.flush();
+        if (!writer.ok()) ok = false;
+    });
+    if (partial_row && pwrite(fd, "\n", 1, static_cast<off_t>(offset[n])) != 1) ok = false;
+    return ok;
+}
+
+// Writes primes already found on the pool in the chosen -format. -file output to a regular file
+// is written in parallel; pipes, FIFOs and devices cannot be truncated or pwrite() to, so they
+// are written in order like the console. Gaps are only small between neighbours in ascending
+// order, so -sort does not apply to archives.
+template <typename T>
+bool write_found(WorkStealingPool &pool, const std::vector<std::vector<T>> &chunks, int fd,
+                 bool output_to_file, T a, T b, bool sort_ascending) {
+    if (output_format == OutputFormat::gaps) {
+        GapArchiveWriter writer(fd, a, b);
+        print_primes(chunks, true, writer);
+        return writer.ok();
+    }
+    struct stat st;
+    if (output_to_file && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        return write_primes_parallel(pool, chunks, sort_ascending, fd, a, b);
+    }
+    if (output_format == OutputFormat::bin) {
+        uint64_t total = 0;
+        for (const auto &chunk : chunks) total += chunk.size();
+        PrimeFileHeader header = make_prime_file_header<T>(a, b, total, !sort_ascending);
+        if (write(fd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header))) {
+            return false;
+        }
+        BinaryWriter writer(fd);
+        print_primes(chunks, sort_ascending, writer);
+        return writer.ok();
+    }
+    TextWriter writer(fd, columns);
+    print_primes(chunks, sort_ascending, writer);
+    return writer.ok();
+}
+
+void print_thread_report(const std::vector<WorkerStats> &stats) {
+    if (hush) return;
+    if (engine == Engine::sieve) {
+        const DataCaches &caches = data_caches();
+        std::cout << "Sieve: " << (sieve_segment_bytes() >> 10) << " KiB segments, "
+                  << (sieve_block_bytes() >> 10) << " KiB pattern blocks (L1d "
+                  << (caches.l1d >> 10) << " KiB, L2 " << (caches.l2 >> 10) << " KiB), "
+                  << sieve_kernel().name << " kernel\n";
+    } else {
+        std::cout << "Trial division: batches of " << TEST_BATCH_SIZE << " candidates, "
+                  << sieve_kernel().name << " kernel\n";
+    }
+    for (const auto &worker : stats) {
+        std::cout << "Thread " << worker.id;
+        if (const CpuInfo *cpu = cpu_info(worker.cpu)) {
+            std::cout << (worker_cpus.empty() ? " on CPU " : " pinned to CPU ") << cpu->cpu
+                      << " (node " << cpu->node << ", package " << cpu->package << ", core "
+                      << cpu->core << ", SMT sibling " << cpu->sibling << ")";
+        }
+        std::cout << " finished in " << worker.busy_ms << " ms (" << worker.tasks << " tasks, "
+                  << worker.steals << " steals)\n";
+    }
+}
+
+// [a, b] cut at origin + k * size into `count` tasks. origin is a itself, except with a sieve
+// cache: then it is the start of a's cache block and size a multiple of the block span, so that
+// each block is sieved and stored by a single task.
+template <typename T>
+struct TaskGrid {
+    T a, b, origin;
+    uint64_t size, count;
+
+    std::pair<T, T> bounds(uint64_t task) const {
+        T start = task == 0 ? a : static_cast<T>(origin + task * size);
+        T end = (task == count - 1) ? b : static_cast<T>(origin + (task + 1) * size - 1);
+        return {start, end};
+    }
+};
+
+template <typename T>
+TaskGrid<T> make_task_grid(T a, T b, uint64_t task_size) {
+    T origin = a;
+    if (sieve_cache && engine == Engine::sieve) {
+        constexpr uint64_t span = SieveCache::BLOCK_SPAN;
+        task_size = (task_size + span - 1) / span * span;
+        origin = static_cast<T>(a / span * span);
+    }
+    return {a, b, origin, task_size, static_cast<uint64_t>(b - origin) / task_size + 1};
+}
+
+// --stream: fixed-size chunks are handed out in output order through a ReorderWindow and written
+// as soon as they and every chunk before them are done. Memory is bounded by the window rather
+// than by the number of primes in [a, b]. Returns how many primes were written.
+template <typename T, typename Writer>
+uint64_t run_streaming(T a, T b, int threads, Writer &writer, bool ascending) {
+    TaskGrid<T> grid = make_task_grid(a, b, STREAM_TASK_SIZE);
+    uint64_t tasks = grid.count;
+    ReorderWindow<std::vector<T>> window(tasks, STREAM_WINDOW_PER_THREAD * threads);
+
+    std::vector<WorkerStats> stats(threads);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < threads; ++w) {
+        workers.emplace_back([&, w] {
+            if (!worker_cpus.empty()) pin_current_thread(worker_cpus[w]);
+            auto start_time = std::chrono::high_resolution_clock::now();
+            stats[w].id = std::this_thread::get_id();
+            std::size_t task;
+            while (window.acquire(task)) {
+                uint64_t chunk = ascending ? task : tasks - 1 - task;
+                auto [start, end] = grid.bounds(chunk);
+                std::vector<T> local_primes;
+                find_primes(start, end, local_primes);
+                window.publish(task, std::move(local_primes));
+                ++stats[w].tasks;
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::high_resolution_clock::now() - start_time;
+            stats[w].busy_ms = elapsed.count();
+            stats[w].cpu = sched_getcpu();
+        });
+    }
+
+    uint64_t total = 0;
+    std::vector<T> chunk;
+    while (window.take(chunk)) {
+        write_chunk(writer, chunk, ascending);
+        total += chunk.size();
+    }
+    writer.finish();
+
+    for (auto &t : workers) {
+        t.join();
+    }
+    print_thread_report(stats);
+    return total;
+}
+
+// Many more tasks than threads, so that workers which finish early can steal the rest. Sieve
+// tasks are at least sqrt(b) wide: each one pays a division per base prime before its first hit,
+// which would outweigh the sieving itself in narrower tasks far from zero.
+template <typename T>
+TaskGrid<T> make_pool_grid(const WorkStealingPool &pool, T a, T b) {
+    uint64_t range = static_cast<uint64_t>(b - a) + 1;
+    uint64_t task_size = std::max(MIN_TASK_SIZE, range / (TASKS_PER_THREAD * pool.size()));
+    if (engine == Engine::sieve) task_size = std::max(task_size, isqrt(b));
+    return make_task_grid(a, b, task_size);
+}
+
+// Number of primes in [a, b], counted task by task on the pool.
+template <typename T>
+uint64_t count_parallel(WorkStealingPool &pool, T a, T b) {
+    TaskGrid<T> grid = make_pool_grid(pool, a, b);
+    std::vector<uint64_t> chunk_counts(grid.count);
+    pool.run(grid.count, [&](std::size_t task, int) {
+        auto [start, end] = grid.bounds(task);
+        chunk_counts[task] = count_primes(start, end);
+    });
+    uint64_t total = 0;
+    for (uint64_t count : chunk_counts) total += count;
+    return total;
+}
+
+// Finds the primes in [a, b] on the pool, one slot of `chunks` per task.
+template <typename T>
+void find_parallel(WorkStealingPool &pool, T a, T b, std::vector<std::vector<T>> &chunks) {
+    TaskGrid<T> grid = make_pool_grid(pool, a, b);
+    chunks.assign(grid.count, {});
+    pool.run(grid.count, [&](std::size_t task, int) {
+        auto [start, end] = grid.bounds(task);
+        find_primes(start, end, chunks[task]);
+    });
+}
+
+// Number of primes in [a, b] for --count and server queries: pi(b) - pi(a - 1) when the engine
+// was left on auto and that is cheaper than sieving, count_parallel() otherwise.
+template <typename T>
+uint64_t count_range(WorkStealingPool &pool, T a, T b) {
+    if (auto_prime_pi && prime_pi_pays_off(a, b)) {
+        return prime_pi(b, pool) - prime_pi(a - 1, pool);
+    }
+    reach_base_primes(b);
+    return count_parallel(pool, a, b);
+}
+
+// Collects the first n primes met going from `from` towards `limit` (upwards or downwards),
+// sieving windows sized for the primes still missing. The window's slots are appended to chunks
+// in walking order, the last one trimmed so that the walk stops at the n-th prime: chunks.back()
+// ends with it going up and starts with it going down. Returns how many primes were collected,
+// fewer than n only if limit came first.
+template <typename T>
+uint64_t sieve_outward(WorkStealingPool &pool, T from, T limit, uint64_t n, bool upward,
+                       std::vector<std::vector<T>> &chunks) {
+    uint64_t found = 0;
+    for (T x = from; found < n;) {
+        // Room for the missing primes at the density 1 / ln(x) near the far end, plus 10% so
+        // that one window is usually enough.
+        double log_x = std::log(std::max<double>(x, 16));
+        if (upward) log_x = std::log(x + (n - found) * log_x);
+        double expected = 1.1 * static_cast<double>(n - found) * log_x + (1 << 12);
+        uint64_t room = upward ? limit - x : x - limit;
+        uint64_t width = expected >= static_cast<double>(room) ? room
+                                                               : static_cast<uint64_t>(expected);
+        T lo = upward ? x : static_cast<T>(x - width);
+        T hi = upward ? static_cast<T>(x + width) : x;
+
+        reach_base_primes(hi);
+        std::vector<std::vector<T>> window;
+        find_parallel(pool, lo, hi, window);
+        for (std::size_t i = 0; i < window.size() && found < n; ++i) {
+            std::vector<T> &slot = window[upward ? i : window.size() - 1 - i];
+            if (slot.empty()) continue;
+            uint64_t keep = std::min<uint64_t>(slot.size(), n - found);
+            if (upward) {
+                slot.resize(keep);
+            } else {
+                slot.erase(slot.begin(), slot.end() - keep);
+            }
+            found += keep;
+            chunks.push_back(std::move(slot));
+        }
+
+        if (width == room) break;
+        x = upward ? hi + 1 : lo - 1;
     }
+    return found;
+}
+
+// The k-th prime of [a, b], k >= 1. Jumps to the estimate x = R^-1(R(a - 1) + k), counts the
+// primes in [a, x] with count_range() (LMO where that is cheaper), then sieves outward from x
+// for the few primes the estimate was off by. False if [a, b] holds fewer than k primes.
+bool nth_prime(WorkStealingPool &pool, uint64_t a, uint64_t b, uint64_t k, uint64_t &prime) {
+    uint64_t x = std::min(riemann_r_inverse(riemann_r(a - 1) + k), b);
+    if (x < a) x = a - 1;
+    uint64_t below = x < a ? 0 : count_range(pool, a, x);
+
+    std::vector<std::vector<uint64_t>> chunks;
+    if (below >= k) {  // The answer is the (below - k + 1)-th prime counting down from x
+        sieve_outward(pool, x, a, below - k + 1, false, chunks);
+        prime = chunks.back().front();
+        return true;
+    }
+    if (x == b || sieve_outward(pool, x + 1, b, k - below, true, chunks) < k - below) return false;
+    prime = chunks.back().back();
+    return true;
+}
+
+// Returns the exit status: 1 if the output file cannot be opened or written.
+template <typename T>
+int run(T a, T b, int threads, const std::string &filename, bool output_to_file,
+        bool sort_ascending) {
+    if (count_only) {
+        WorkStealingPool pool(threads, worker_cpus);
+        uint64_t total = count_range(pool, a, b);
+
+        if (output_to_file) {
+            std::ofstream outfile(filename);
+            outfile << "{\"a\": " << a << ", \"b\": " << b << ", \"count\": " << total << "}\n";
+            outfile.close();
+            if (!outfile) {
+                std::cerr << "Failed to write the count to " << filename << "\n";
+                return 1;
+            }
+        } else {
+            std::cout << "There are " << total << " primes in [" << a << ", " << b << "]\n";
+        }
+        print_thread_report(pool.stats());
+        return 0;
+    }
+
+    if (nth_index) {
+        WorkStealingPool pool(threads, worker_cpus);
+        uint64_t prime;
+        int status = 0;
+        if (!nth_prime(pool, a, b, nth_index, prime)) {
+            std::cerr << "There are fewer than " << nth_index << " primes in [" << a << ", " << b
+                      << "]\n";
+            status = 1;
+        } else if (output_to_file) {
+            std::ofstream outfile(filename);
+            outfile << "{\"a\": " << a << ", \"b\": " << b << ", \"nth\": " << nth_index
+                    << ", \"prime\": " << prime << "}\n";
+            outfile.close();
+            if (!outfile) {
+                std::cerr << "Failed to write the prime to " << filename << "\n";
+                status = 1;
+            }
+        } else {
+            std::cout << "Prime number " << nth_index << " of [" << a << ", " << b << "] is "
+                      << prime << "\n";
+        }
+        print_thread_report(pool.stats());
+        return status;
+    }
+
+    int fd = STDOUT_FILENO;
+    if (output_to_file) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Cannot open " << filename << ": " << std::strerror(errno) << "\n";
+            return 1;
+        }
+    }
+
+    bool ok;
+    bool complete = true;  // False if -next ran out of primes before next_count
+    if (stream && output_format == OutputFormat::gaps) {
+        // Always ascending, see write_found(). Each chunk is encoded as soon as it is available;
+        // no global list is built.
+        GapArchiveWriter writer(fd, a, b);
+        run_streaming(a, b, threads, writer, true);
+        ok = writer.ok();
+    } else if (stream && output_format == OutputFormat::bin) {
+        // The count is only known at the end, so the header is written again once it is.
+        PrimeFileHeader header = make_prime_file_header<T>(a, b, 0, !sort_ascending);
+        ok = write(fd, &header, sizeof(header)) == static_cast<ssize_t>(sizeof(header));
+        BinaryWriter writer(fd);
+        uint64_t total = run_streaming(a, b, threads, writer, sort_ascending);
+        header = make_prime_file_header<T>(a, b, total, !sort_ascending);
+        ok = ok && writer.ok() &&
+             pwrite(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    } else if (stream) {
+        TextWriter writer(fd, columns);
+        run_streaming(a, b, threads, writer, sort_ascending);
+        ok = writer.ok();
+    } else {
+        WorkStealingPool pool(threads, worker_cpus);
+        if (next_count) {
+            // The output then covers [a, last prime found], which is what bin and gaps headers
+            // record as the range.
+            uint64_t found = sieve_outward(pool, a, b, next_count, true, chunk_primes<T>);
+            if (found < next_count) {
+                std::cerr << "There are only " << found << " primes in [" << a << ", " << b
+                          << "]\n";
+                complete = false;
+            }
+            if (found > 0) b = chunk_primes<T>.back().back();
+        } else {
+            find_parallel(pool, a, b, chunk_primes<T>);
+        }
+        ok = write_found(pool, chunk_primes<T>, fd, output_to_file, a, b, sort_ascending);
+        print_thread_report(pool.stats());
+    }
+
+    if (!ok) {
+        std::cerr << "Failed to write the primes: " << std::strerror(errno) << "\n";
+    }
+    if (output_to_file) close(fd);
+    return ok && complete ? 0 : 1;
+}
+
+// Outcome of one -input batch: the primes among its candidates or, with --bitmap, a 0 or 1 per
+// candidate.
+struct BatchResult {
+    std::vector<uint64_t> primes;
+    std::vector<uint8_t> flags;
+    uint64_t candidates = 0;
+    uint64_t prime_count = 0;
+    std::string bad;  // Set if the batch holds something other than candidates
+};
+
+// -input: like --stream, but the tasks are batches of candidates, handed out in input order
+// through a ReorderWindow and written back in the same order. A worker claims its task and reads
+// its batch under one lock, so task k always gets the k-th batch; parsing and testing run in
+// parallel.
+int run_input(const std::string &path, InputFormat format, int threads, const std::string &filename,
+              bool output_to_file, bool bitmap) {
+    std::unique_ptr<CandidateReader> reader;
+    try {
+        reader = std::make_unique<CandidateReader>(path, format);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    ReorderWindow<BatchResult> window(SIZE_MAX, STREAM_WINDOW_PER_THREAD * threads);
+    std::mutex input_mutex;
+
+    std::vector<WorkerStats> stats(threads);
+    std::vector<std::thread> workers;
+    for (int w = 0; w < threads; ++w) {
+        workers.emplace_back([&, w] {
+            if (!worker_cpus.empty()) pin_current_thread(worker_cpus[w]);
+            auto start_time = std::chrono::high_resolution_clock::now();
+            stats[w].id = std::this_thread::get_id();
+            std::vector<uint64_t> values;
+            std::vector<uint8_t> prime;
+            while (true) {
+                std::size_t task;
+                CandidateBatch batch;
+                {
+                    std::lock_guard<std::mutex> lock(input_mutex);
+                    if (!window.acquire(task)) break;
+                    if (!reader->next(batch)) {
+                        window.end_at(task);
+                        break;
+                    }
+                }
+                BatchResult result;
+                values.clear();
+                if (parse_candidates(batch, format, values, result.bad)) {
+                    result.candidates = values.size();
+                    prime.resize(values.size());
+                    for (std::size_t i = 0; i < values.size(); i += TEST_BATCH_SIZE) {
+                        std::size_t size = std::min(TEST_BATCH_SIZE, values.size() - i);
+                        test_batch(values.data() + i, size, prime.data() + i, is_prime_candidate);
+                    }
+                    for (std::size_t i = 0; i < values.size(); ++i) {
+                        result.prime_count += prime[i];
+                        if (prime[i] && !bitmap && !count_only) result.primes.push_back(values[i]);
+                    }
+                    if (bitmap) result.flags = prime;
+                }
+                window.publish(task, std::move(result));
+                ++stats[w].tasks;
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::high_resolution_clock::now() - start_time;
+            stats[w].busy_ms = elapsed.count();
+            stats[w].cpu = sched_getcpu();
+        });
+    }
+
+    int fd = STDOUT_FILENO;
+    if (output_to_file && !count_only) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Cannot open " << filename << ": " << std::strerror(errno) << "\n";
+            return 1;
+        }
+    }
+    std::optional<TextWriter> text;
+    std::optional<BinaryWriter> bits;
+    if (bitmap) {
+        bits.emplace(fd);
+    } else if (!count_only) {
+        text.emplace(fd, columns);
+    }
+
+    // Once a batch turns out to be invalid, the rest are still taken so the workers can finish,
+    // but nothing more is written.
+    uint64_t candidates = 0, primes = 0, flagged = 0;
+    uint8_t byte = 0;
+    std::string bad;
+    BatchResult result;
+    while (window.take(result)) {
+        if (!bad.empty()) continue;
+        bad = result.bad;
+        candidates += result.candidates;
+        primes += result.prime_count;
+        if (text) text->write(result.primes.begin(), result.primes.end());
+        for (uint8_t flag : result.flags) {
+            byte |= flag << (flagged % 8);
+            if (++flagged % 8 == 0) {
+                bits->write(byte);
+                byte = 0;
+            }
+        }
+    }
+    if (flagged % 8 != 0) bits->write(byte);
+    bool ok = true;
+    if (text) {
+        text->finish();
+        ok = text->ok();
+    } else if (bits) {
+        bits->finish();
+        ok = bits->ok();
+    }
+
+    for (auto &t : workers) {
+        t.join();
+    }
+    if (output_to_file && !count_only) close(fd);
+
+    if (!bad.empty()) {
+        std::cerr << "Invalid candidate in " << path << ": " << bad << "\n";
+        return 1;
+    }
+    if (reader->error()) {
+        std::cerr << "Cannot read " << path << ": " << std::strerror(reader->error()) << "\n";
+        return 1;
+    }
+    if (!ok) {
+        std::cerr << "Failed to write the primes: " << std::strerror(errno) << "\n";
+        return 1;
+    }
+    if (count_only && output_to_file) {
+        std::ofstream outfile(filename);
+        outfile << "{\"candidates\": " << candidates << ", \"count\": " << primes << "}\n";
+    } else if (count_only) {
+        std::cout << "There are " << primes << " primes among " << candidates << " candidates\n";
+    }
+    print_thread_report(stats);
+    return 0;
+}
+
+// Smallest prime > n that is <= limit, searched in windows that double from 2^12 numbers.
+bool next_prime(uint64_t n, uint64_t limit, uint64_t &prime) {
+    if (n >= limit) return false;
+    uint64_t width = 1 << 12;
+    for (uint64_t lo = n + 1;;) {
+        uint64_t hi = limit - lo < width ? limit : lo + width - 1;
+        std::vector<uint64_t> found;
+        find_primes(lo, hi, found);
+        if (!found.empty()) {
+            prime = found.front();
+            return true;
+        }
+        if (hi == limit) return false;
+        lo = hi + 1;
+        width = std::min<uint64_t>(width * 2, SERVE_PARALLEL_SIZE);
+    }
+}
+
+// Largest prime < n that is >= floor, searched the same way going down.
+bool prev_prime(uint64_t n, uint64_t floor, uint64_t &prime) {
+    if (n <= floor) return false;
+    uint64_t width = 1 << 12;
+    for (uint64_t hi = n - 1;;) {
+        uint64_t lo = hi - floor < width ? floor : hi - width + 1;
+        std::vector<uint64_t> found;
+        find_primes(lo, hi, found);
+        if (!found.empty()) {
+            prime = found.back();
+            return true;
+        }
+        if (lo == floor) return false;
+        hi = lo - 1;
+        width = std::min<uint64_t>(width * 2, SERVE_PARALLEL_SIZE);
+    }
+}
+
+// Answers one -serve request line:
+//   is_prime N   -> OK 1 | OK 0
+//   count A B    -> OK <primes in [A, B]>
+//   range A B    -> OK <count> <p1> <p2> ...
+//   next N       -> OK <smallest prime > N>
+//   prev N       -> OK <largest prime < N>
+// Numbers must lie within the served [a, b]; anything else gets "ERR <reason>". Wide count and
+// range queries run on the shared pool, one at a time; the rest run on the connection's thread.
+std::string answer_query(const std::string &line, uint64_t a, uint64_t b, WorkStealingPool &pool,
+                         std::mutex &pool_mutex) {
+    std::istringstream words(line);
+    std::string command, word;
+    std::vector<uint64_t> args;
+    words >> command;
+    while (words >> word) {
+        uint64_t value;
+        auto [end, error] = std::from_chars(word.data(), word.data() + word.size(), value);
+        if (error != std::errc() || end != word.data() + word.size()) {
+            return "ERR not a number: " + word;
+        }
+        args.push_back(value);
+    }
+
+    std::size_t arity = (command == "count" || command == "range") ? 2 : 1;
+    if (command != "is_prime" && command != "count" && command != "range" &&
+        command != "next" && command != "prev") {
+        return "ERR unknown command: " + command;
+    }
+    if (args.size() != arity) {
+        return "ERR " + command + " takes " + std::to_string(arity) + " number(s)";
+    }
+    for (uint64_t value : args) {
+        if (value < a || value > b) {
+            return "ERR " + std::to_string(value) + " is outside the served range [" +
+                   std::to_string(a) + ", " + std::to_string(b) + "]";
+        }
+    }
+
+    if (command == "is_prime") {
+        return test_prime(args[0]) ? "OK 1" : "OK 0";
+    }
+    if (command == "next" || command == "prev") {
+        uint64_t prime;
+        bool found = command == "next" ? next_prime(args[0], b, prime)
+                                       : prev_prime(args[0], a, prime);
+        if (!found) {
+            return std::string("ERR no prime ") + (command == "next" ? "after " : "before ") +
+                   std::to_string(args[0]) + " in the served range";
+        }
+        return "OK " + std::to_string(prime);
+    }
+
+    uint64_t lo = args[0];
+    uint64_t hi = args[1];
+    if (lo > hi) return "ERR empty range";
+    bool parallel = hi - lo >= SERVE_PARALLEL_SIZE;
+    if (command == "count") {
+        if (!parallel) return "OK " + std::to_string(count_primes(lo, hi));
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        return "OK " + std::to_string(count_range(pool, lo, hi));
+    }
+
+    if (hi - lo >= SERVE_MAX_RANGE) return "ERR range is wider than 2^30, use count";
+    std::vector<std::vector<uint64_t>> chunks;
+    if (parallel) {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        find_parallel(pool, lo, hi, chunks);
+    } else {
+        chunks.emplace_back();
+        find_primes(lo, hi, chunks.back());
+    }
+    uint64_t total = 0;
+    for (const auto &chunk : chunks) total += chunk.size();
+    std::string reply = "OK " + std::to_string(total);
+    char digits[24];
+    for (const auto &chunk : chunks) {
+        for (uint64_t prime : chunk) {
+            reply += ' ';
+            reply.append(digits, std::to_chars(digits, digits + sizeof(digits), prime).ptr);
+        }
+    }
+    return reply;
+}
+
+// -serve: keeps the base primes, a worker pool and the sieve cache resident and answers queries
+// on a Unix socket until the process is stopped.
+int serve(uint64_t a, uint64_t b, int threads, const std::string &socket_path) {
+    WorkStealingPool pool(threads, worker_cpus);
+    std::mutex pool_mutex;
+    try {
+        QueryServer server(socket_path, [&](const std::string &line) {
+            return answer_query(line, a, b, pool, pool_mutex);
+        });
+        if (!hush) {
+            std::cout << "Serving [" << a << ", " << b << "] on " << socket_path << std::endl;
+        }
+        server.serve();
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
@@ -145,61 +1073,110 @@ int main(int argc, char *argv[]) {
     //     return 1;
     // }
 
-    int a, b, threads;
+    uint64_t a, b;
+    int threads;
     std::string filename;
     bool output_to_file, sort_ascending;
+    std::string cache_dir, socket_path, kernel_name;
+    uint64_t cache_size_mib, segment_kib;
+    Affinity affinity;
+    bool physical_cores;
+    std::string input_path;
+    InputFormat input_format;
+    bool bitmap;
     parse_arguments(argc, argv, a, b, filename, threads, output_to_file, sort_ascending, hush,
-                    columns);
+                    columns, engine, count_only, stream, output_format, cache_dir,
+                    cache_size_mib, socket_path, nth_index, next_count, kernel_name,
+                    segment_kib, affinity, physical_cores, input_path, input_format, bitmap);
 
-    if (a >= b || a < 1 || b < 1) {
+    if (input_path.empty() && (a >= b || a < 1 || b < 1)) {
         std::cerr << "Invalid range. Ensure that a < b and both are positive integers.\n";
         return 1;
     }
-
-    std::vector<std::thread> thread_pool;
-    int range = (b - a + 1);
-    int chunk_size = range / threads;
-    int start = a;
-
-    for (int i = 0; i < threads; ++i) {
-        int end = (i == threads - 1) ? b : start + chunk_size - 1;
-        thread_pool.emplace_back(find_primes, start, end);
-        start += chunk_size;
+    if (threads < 1 || columns < 1) {
+        std::cerr << "Invalid options. Ensure that -threads and -columns are positive.\n";
+        return 1;
     }
-
-    for (auto &t : thread_pool) {
-        t.join();
+    if (output_format != OutputFormat::text && !output_to_file && !count_only && !nth_index) {
+        std::cerr << "Invalid options. Binary output formats need -file.\n";
+        return 1;
     }
-
-    if (!sort_ascending) {
-        std::sort(primes.begin(), primes.end(), std::greater<int>());
-    } else {
-        std::sort(primes.begin(), primes.end());
+    if (kernel_name != "auto" && !force_sieve_kernel(kernel_name)) {
+        std::cerr << "Invalid options. The '" << kernel_name
+                  << "' kernel does not exist or this CPU cannot run it.\n";
+        return 1;
     }
-
-    if (output_to_file) {
-        std::ofstream outfile(filename);
-        int count = 0;
-        for (const auto &prime : primes) {
-            outfile << prime << "\t";
-            if (++count % columns == 0) {
-                outfile << "\n";
-            }
+    if (segment_kib && (segment_kib > SIEVE_SEGMENT_MAX_BYTES >> 10 ||
+                        !set_sieve_segment_bytes(segment_kib << 10))) {
+        std::cerr << "Invalid options. -segment-size must be between "
+                  << (SIEVE_SEGMENT_MIN_BYTES >> 10) << " and " << (SIEVE_SEGMENT_MAX_BYTES >> 10)
+                  << " KiB.\n";
+        return 1;
+    }
+    worker_cpus = plan_worker_cpus(affinity, threads, physical_cores);
+    if (!input_path.empty()) {
+        if (a || b || !socket_path.empty() || nth_index || next_count || !cache_dir.empty() ||
+            output_format != OutputFormat::text) {
+            std::cerr << "Invalid options. -input replaces [a, b] and cannot be combined with "
+                         "-serve, -nth, -next, -cache or -format.\n";
+            return 1;
         }
-        if (count % columns != 0) {
-            outfile << "\n";
+        return run_input(input_path, input_format, threads, filename, output_to_file,
+                         bitmap && !count_only);
+    }
+    if ((nth_index || next_count) &&
+        ((nth_index && next_count) || count_only || stream || !socket_path.empty())) {
+        std::cerr << "Invalid options. -nth and -next cannot be combined with each other, "
+                     "--count, --stream or -serve.\n";
+        return 1;
+    }
+
+    // Sieving pays about sqrt(b) up front for the base primes, while testing a number costs a
+    // bounded number of Miller-Rabin rounds, so windows narrower than about sqrt(b) / 64 are
+    // tested number by number.
+    uint64_t sqrt_b = isqrt(b);
+    // A server answers many small queries, each of which sieves faster than it tests one number
+    // after the other, and -nth and -next only sieve the windows they need, however wide [a, b]
+    // is.
+    if (engine == Engine::automatic) {
+        auto_prime_pi = true;
+        bool sieve = b - a >= sqrt_b / 64 || !socket_path.empty() || nth_index || next_count;
+        engine = sieve ? Engine::sieve : Engine::trial;
+    }
+    if (engine == Engine::sieve && !cache_dir.empty()) {
+        try {
+            sieve_cache = std::make_unique<SieveCache>(cache_dir, cache_size_mib << 20);
+        } catch (const std::runtime_error &err) {
+            std::cerr << "Cannot use the sieve cache: " << err.what() << "\n";
+            return 1;
         }
-        outfile.close();
+        // Whole blocks are sieved, so the base primes must reach the end of b's block.
+        sqrt_b = isqrt(SieveCache::sieve_limit(b));
+    }
+    // -nth and -next may stop far below b, so they generate base primes as they go.
+    if (engine == Engine::sieve && !nth_index && !next_count) {
+        base_primes = generate_primes(static_cast<uint32_t>(sqrt_b));
+        base_primes_reach = sqrt_b;
+    }
+
+    if (!socket_path.empty()) return serve(a, b, threads, socket_path);
+
+    // Results stay in 4-byte integers whenever the range allows it.
+    int status;
+    if (b <= UINT32_MAX) {
+        status = run<uint32_t>(static_cast<uint32_t>(a), static_cast<uint32_t>(b), threads,
+                               filename, output_to_file, sort_ascending);
     } else {
-        print_primes(primes, columns);
+        status = run<uint64_t>(a, b, threads, filename, output_to_file, sort_ascending);
     }
 
-    if (!hush) {
-        for (const auto &time_record : thread_times) {
-            std::cout << "Thread " << time_record.first << " finished in " << time_record.second
-                      << " ms\n";
+    if (sieve_cache) {
+        uint64_t evicted = sieve_cache->trim();
+        if (!hush) {
+            std::cout << "Cache: " << sieve_cache->hits() << " blocks reused, "
+                      << sieve_cache->stored() << " blocks added, " << evicted << " evicted\n";
         }
     }
 
-    return 0;
-}
\ No newline at end of file
+    return status;
+}
@@ -0,0 +1,285 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "kernels.hpp"
+
+__extension__ typedef unsigned __int128 uint128_t;  // GCC/Clang; -pedantic wants the marker
+
+// Trial division by 6k +- 1 up to sqrt(n), for any n: the reference that is_prime_small() and
+// Miller-Rabin are checked and timed against in build/primality_bench.
+template <typename T>
+bool is_prime_trial(T n) {
+    if (n <= 1) return false;
+    if (n <= 3) return true;
+    if (n % 2 == 0 || n % 3 == 0) return false;
+    for (T i = 5; i <= n / i; i += 6) {
+        if (n % i == 0 || n % (i + 2) == 0) return false;
+    }
+    return true;
+}
+
+// 1021 is the largest prime of TRIAL_DIVISORS (the next prime, 1031, is not in it), so
+// is_prime_small() has every divisor it needs below 1021^2. A larger table raises this limit;
+// a larger limit alone does not.
+constexpr std::uint32_t TRIAL_DIVISION_LIMIT = 1021 * 1021;
+
+// Trial division by the primes up to sqrt(n) from TRIAL_DIVISORS, each one a multiplication and
+// a compare instead of a division. For n < TRIAL_DIVISION_LIMIT; cheapest for small n, see
+// IS_PRIME_TRIAL_LIMIT.
+inline bool is_prime_small(std::uint32_t n) {
+    if (n % 2 == 0) return n == 2;
+    for (const TrialDivisor &t : TRIAL_DIVISORS.divisor) {
+        if (t.prime * t.prime > n) break;
+        if (n * t.inverse <= t.max) return false;
+    }
+    return n > 1;
+}
+
+// Arithmetic modulo an odd n in Montgomery form (R = 2^64): products are reduced with two
+// multiplications and no division.
+class Montgomery64 {
+   public:
+    explicit Montgomery64(std::uint64_t n) : n_(n), inverse_(n) {
+        for (int i = 0; i < 5; ++i) inverse_ *= 2 - n * inverse_;  // Newton: 3 -> 96 bits
+        one_ = (0 - n) % n;                                        // R mod n
+    }
+
+    std::uint64_t one() const { return one_; }
+
+    // a * R mod n, for a < n.
+    std::uint64_t to_montgomery(std::uint64_t a) const {
+        return static_cast<std::uint64_t>((static_cast<uint128_t>(a) << 64) % n_);
+    }
+
+    // a * b / R mod n, for a, b < n. The low words of t and m * n cancel, so only the high words
+    // are subtracted, which cannot overflow even for n close to 2^64.
+    std::uint64_t multiply(std::uint64_t a, std::uint64_t b) const {
+        uint128_t t = static_cast<uint128_t>(a) * b;
+        std::uint64_t m = static_cast<std::uint64_t>(t) * inverse_;
+        std::uint64_t t_high = static_cast<std::uint64_t>(t >> 64);
+        std::uint64_t mn_high = static_cast<std::uint64_t>((static_cast<uint128_t>(m) * n_) >> 64);
+        return t_high >= mn_high ? t_high - mn_high : t_high - mn_high + n_;
+    }
+
+    std::uint64_t power(std::uint64_t base, std::uint64_t exponent) const {
+        std::uint64_t result = one_;
+        for (; exponent; exponent >>= 1) {
+            if (exponent & 1) result = multiply(result, base);
+            base = multiply(base, base);
+        }
+        return result;
+    }
+
+   private:
+    std::uint64_t n_;
+    std::uint64_t inverse_;  // n^-1 mod R
+    std::uint64_t one_;
+};
+
+// Montgomery64 for odd n < 2^32 (R = 2^32), in 64-bit products.
+class Montgomery32 {
+   public:
+    explicit Montgomery32(std::uint32_t n) : n_(n), inverse_(n) {
+        for (int i = 0; i < 4; ++i) inverse_ *= 2 - n * inverse_;  // Newton: 3 -> 48 bits
+        one_ = (0 - n) % n;
+    }
+
+    std::uint32_t one() const { return one_; }
+
+    std::uint32_t to_montgomery(std::uint32_t a) const {
+        return static_cast<std::uint32_t>((static_cast<std::uint64_t>(a) << 32) % n_);
+    }
+
+    std::uint32_t multiply(std::uint32_t a, std::uint32_t b) const {
+        std::uint64_t t = static_cast<std::uint64_t>(a) * b;
+        std::uint32_t m = static_cast<std::uint32_t>(t) * inverse_;
+        std::uint32_t t_high = static_cast<std::uint32_t>(t >> 32);
+        std::uint32_t mn_high =
+            static_cast<std::uint32_t>((static_cast<std::uint64_t>(m) * n_) >> 32);
+        return t_high >= mn_high ? t_high - mn_high : t_high - mn_high + n_;
+    }
+
+    std::uint32_t power(std::uint32_t base, std::uint32_t exponent) const {
+        std::uint32_t result = one_;
+        for (; exponent; exponent >>= 1) {
+            if (exponent & 1) result = multiply(result, base);
+            base = multiply(base, base);
+        }
+        return result;
+    }
+
+   private:
+    std::uint32_t n_;
+    std::uint32_t inverse_;  // n^-1 mod R
+    std::uint32_t one_;
+};
+
+// Primes the Miller-Rabin test divides by first; most composites stop here.
+constexpr std::uint32_t MILLER_RABIN_PREFILTER[] = {2,  3,  5,  7,  11, 13, 17, 19, 23,
+                                                    29, 31, 37, 41, 43, 47, 53};
+
+// The odd prefilter primes with the TrialDivisor constants widened to 64 bits: n is a multiple
+// of p exactly when n * p^-1 mod 2^64 <= (2^64 - 1) / p.
+struct PrefilterDivisor {
+    std::uint64_t prime, inverse, max;
+};
+
+struct PrefilterDivisorTable {
+    PrefilterDivisor divisor[std::size(MILLER_RABIN_PREFILTER) - 1];
+
+    constexpr PrefilterDivisorTable() : divisor() {
+        for (std::size_t k = 0; k + 1 < std::size(MILLER_RABIN_PREFILTER); ++k) {
+            std::uint64_t p = MILLER_RABIN_PREFILTER[k + 1];
+            std::uint64_t inverse = p;
+            for (int i = 0; i < 5; ++i) inverse *= 2 - p * inverse;  // Newton: 3 -> 96 bits
+            divisor[k] = {p, inverse, UINT64_MAX / p};
+        }
+    }
+};
+inline constexpr PrefilterDivisorTable PREFILTER_DIVISORS{};
+
+// Deterministic for every n < 2^64 (Jim Sinclair's seven bases): a base that is a multiple of
+// n is skipped.
+constexpr std::uint64_t MILLER_RABIN_BASES[] = {2,      325,     9375,      28178,
+                                                450775, 9780504, 1795265022};
+
+// Strong probable prime test of odd n to base a (in Montgomery form), with n - 1 = d * 2^s.
+template <typename Montgomery, typename U>
+bool strong_probable_prime(const Montgomery &mod, U n, U a, U d, int s) {
+    U one = mod.one();
+    U minus_one = n - one;  // (n - 1) * R mod n
+    U x = mod.power(a, d);
+    if (x == one || x == minus_one) return true;
+    for (int r = 1; r < s; ++r) {
+        x = mod.multiply(x, x);
+        if (x == minus_one) return true;
+    }
+    return false;
+}
+
+// Deterministic Miller-Rabin in Montgomery arithmetic, after trial division by the prefilter
+// primes. At most seven modular exponentiations, whatever the size of n.
+inline bool is_prime_miller_rabin(std::uint64_t n) {
+    if (n % 2 == 0) return n == 2;
+    for (const PrefilterDivisor &t : PREFILTER_DIVISORS.divisor) {
+        if (n * t.inverse <= t.max) return n == t.prime;
+    }
+    if (n < 59 * 59) return n > 1;
+
+    Montgomery64 mod(n);
+    std::uint64_t d = n - 1;
+    int s = __builtin_ctzll(d);
+    d >>= s;
+    for (std::uint64_t base : MILLER_RABIN_BASES) {
+        std::uint64_t a = base % n;
+        if (a == 0) continue;
+        if (!strong_probable_prime(mod, n, mod.to_montgomery(a), d, s)) return false;
+    }
+    return true;
+}
+
+// Below this, is_prime_small() runs instead of Miller-Rabin. build/primality_bench measures it
+// 4x faster on average over consecutive numbers at 2^19 (31 ns against 123 ns per number), and
+// 2^19 is the last power of two whose test window stays below TRIAL_DIVISION_LIMIT, so the limit
+// is set by the reach of TRIAL_DIVISORS, not by a measured crossover.
+constexpr std::uint64_t IS_PRIME_TRIAL_LIMIT = 1 << 19;
+static_assert(IS_PRIME_TRIAL_LIMIT <= TRIAL_DIVISION_LIMIT, "is_prime_small() would miss divisors");
+
+template <typename T>
+bool is_prime(T n) {
+    return n < IS_PRIME_TRIAL_LIMIT ? is_prime_small(static_cast<std::uint32_t>(n))
+                                    : is_prime_miller_rabin(static_cast<std::uint64_t>(n));
+}
+
+// One base per hash bucket, so that a single strong probable prime test decides every n < 2^32
+// that survives division by 2, 3, 5 and 7 (Forisek and Jancina, "Fast Primality Testing for
+// Integers That Fit into a Machine Word", 2015).
+constexpr std::uint16_t MR32_HASHED_BASES[256] = {
+    15591, 2018,  166,   7429,  8064,  16045, 10503, 4399,  1949,  1295,  2776,  3620,  560,
+    3128,  5212,  2657,  2300,  2021,  4652,  1471,  9336,  4018,  2398,  20462, 10277, 8028,
+    2213,  6219,  620,   3763,  4852,  5012,  3185,  1333,  6227,  5298,  1074,  2391,  5113,
+    7061,  803,   1269,  3875,  422,   751,   580,   4729,  10239, 746,   2951,  556,   2206,
+    3778,  481,   1522,  3476,  481,   2487,  3266,  5633,  488,   3373,  6441,  3344,  17,
+    15105, 1490,  4154,  2036,  1882,  1813,  467,   3307,  14042, 6371,  658,   1005,  903,
+    737,   1887,  7447,  1888,  2848,  1784,  7559,  3400,  951,   13969, 4304,  177,   41,
+    19875, 3110,  13221, 8726,  571,   7043,  6943,  1199,  352,   6435,  165,   1169,  3315,
+    978,   233,   3003,  2562,  2994,  10587, 10030, 2377,  1902,  5354,  4447,  1555,  263,
+    27027, 2283,  305,   669,   1912,  601,   6186,  429,   1930,  14873, 1784,  1661,  524,
+    3577,  236,   2360,  6146,  2850,  55637, 1753,  4178,  8466,  222,   2579,  2743,  2031,
+    2226,  2276,  374,   2132,  813,   23788, 1610,  4422,  5159,  1725,  3597,  3366,  14336,
+    579,   165,   1375,  10018, 12616, 9816,  1371,  536,   1867,  10864, 857,   2206,  5788,
+    434,   8085,  17618, 727,   3639,  1595,  4944,  2129,  2029,  8195,  8344,  6232,  9183,
+    8126,  1870,  3296,  7455,  8947,  25017, 541,   19115, 368,   566,   5674,  411,   522,
+    1027,  8215,  2050,  6544,  10049, 614,   774,   2333,  3007,  35201, 4706,  1152,  1785,
+    1028,  1540,  3743,  493,   4474,  2521,  26845, 8354,  864,   18915, 5465,  2447,  42,
+    4511,  1660,  166,   1249,  6259,  2553,  304,   272,   7286,  73,    6554,  899,   2816,
+    5197,  13330, 7054,  2818,  3199,  811,   922,   350,   7514,  4452,  3449,  2663,  4708,
+    418,   1621,  1171,  3471,  88,    11345, 412,   1559,  194};
+
+inline unsigned mr32_hash(std::uint32_t n) {
+    std::uint64_t h = n;
+    h = ((h >> 16) ^ h) * 0x45d9f3b;
+    h = ((h >> 16) ^ h) * 0x45d9f3b;
+    return ((h >> 16) ^ h) & 255;
+}
+
+// Hashed single-base Miller-Rabin for 32-bit n: divisibility tests by 2, 3, 5 and 7 and one
+// modular exponentiation.
+inline bool is_prime_mr32(std::uint32_t n) {
+    if (n % 2 == 0) return n == 2;
+    for (std::size_t k = 0; k < 3; ++k) {
+        const TrialDivisor &t = TRIAL_DIVISORS.divisor[k];  // 3, 5, 7
+        if (n * t.inverse <= t.max) return n == t.prime;
+    }
+    if (n < 11 * 11) return n > 1;
+
+    Montgomery32 mod(n);
+    std::uint32_t d = n - 1;
+    int s = __builtin_ctz(d);
+    d >>= s;
+    std::uint32_t a = MR32_HASHED_BASES[mr32_hash(n)] % n;
+    return a == 0 || strong_probable_prime(mod, n, mod.to_montgomery(a), d, s);
+}
+
+// Candidates below this are left to `test` by test_batch(); all others are larger than every
+// trial divisor.
+constexpr std::uint64_t TEST_BATCH_MIN = 1 << 10;
+
+// Sets prime[i] to whether values[i] is prime. While the odd primes of TRIAL_DIVISORS reach the
+// square root of the largest value (below 1021^2), the kernel's trial division decides the whole
+// batch, a vector of candidates per multiplication. Larger batches go through `test` one by one:
+// striking out small factors first saves nothing there, as Miller-Rabin already does so and its
+// cost lies in the candidates without any (measured with build/primality_bench).
+template <typename T, typename Test>
+void test_batch(const T *values, std::size_t count, std::uint8_t *prime, Test test) {
+    T largest = 0;
+    for (std::size_t i = 0; i < count; ++i) largest = std::max(largest, values[i]);
+    std::size_t divisors = 0;
+    while (divisors < TRIAL_DIVISOR_COUNT &&
+           static_cast<std::uint64_t>(TRIAL_DIVISORS.divisor[divisors].prime) *
+                   TRIAL_DIVISORS.divisor[divisors].prime <=
+               largest) {
+        ++divisors;
+    }
+    if (divisors == TRIAL_DIVISOR_COUNT) {
+        for (std::size_t i = 0; i < count; ++i) prime[i] = test(values[i]);
+        return;
+    }
+
+    for (std::size_t i = 0; i < count; ++i) prime[i] = values[i] % 2 != 0;
+    const SieveKernel &kernel = sieve_kernel();
+    if constexpr (sizeof(T) == 4) {
+        kernel.trial_divide32(values, count, divisors, prime);
+    } else {
+        thread_local std::vector<std::uint32_t> narrow;
+        narrow.assign(values, values + count);
+        kernel.trial_divide32(narrow.data(), count, divisors, prime);
+    }
+    for (std::size_t i = 0; i < count; ++i) {
+        if (values[i] < TEST_BATCH_MIN) prime[i] = test(values[i]);
+    }
+}
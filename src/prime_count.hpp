@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "scheduler.hpp"
+#include "sieve.hpp"
+
+// pi(x) with the Lagarias-Miller-Odlyzko method in O(x^(2/3)) time instead of sieving [1, x]:
+//
+//   pi(x) = phi(x, a) + a - 1 - P2(x, a),  a = pi(y),  y = alpha * x^(1/3)
+//   phi(x, a) = S1 + S2
+//
+// S1 sums the ordinary leaves mu(n) * phi(x / n, c) over squarefree n <= y, which a table for the
+// first c = 6 primes answers directly. S2 sums the special leaves
+// -mu(m) * phi(x / (p_b * m), b - 1) with a segmented sieve of [1, x / y) that counts the numbers
+// still unsieved. P2 counts the numbers <= x with exactly two prime factors > y, from pi(x / p)
+// for y < p <= sqrt(x).
+//
+// S2 and P2 are split into tasks on a WorkStealingPool. A special-leaves task cannot know how
+// many unsieved numbers lie below its interval, so it starts from zero and also records, per b,
+// its own count and the sum of -mu over its leaves; the missing part is added back in task order.
+
+// Below this, pi(x) is a plain segmented count.
+constexpr std::uint64_t PRIME_PI_MIN = 1 << 24;
+// LMO is only used below 2^62 so that the signed sums cannot overflow.
+constexpr std::uint64_t PRIME_PI_MAX = std::uint64_t(1) << 62;
+constexpr int PRIME_PI_TASKS_PER_THREAD = 16;
+
+// floor(cbrt(n)).
+inline std::uint64_t icbrt(std::uint64_t n) {
+    std::uint64_t r = static_cast<std::uint64_t>(std::cbrt(static_cast<double>(n)));
+    while (r > 0 && r * r * r > n) --r;
+    while ((r + 1) * (r + 1) * (r + 1) <= n) ++r;
+    return r;
+}
+
+// phi(v, 6): numbers in [1, v] with no prime factor among 2, 3, 5, 7, 11 and 13, which repeats
+// with period 30030.
+class TinyPhi {
+   public:
+    static constexpr int C = 6;
+    static constexpr std::uint32_t PRIMORIAL = 2 * 3 * 5 * 7 * 11 * 13;
+
+    TinyPhi() : counts_(PRIMORIAL), pattern_(PRIMORIAL) {
+        std::uint32_t count = 0;
+        for (std::uint32_t r = 0; r < PRIMORIAL; ++r) {
+            if (coprime(r)) ++count;
+            counts_[r] = count;
+        }
+        // Bit i of the pattern stands for the number i + 1. 64 periods fill a whole number of
+        // words, so a segment starting at 64 * k + 1 copies words with no shifting.
+        for (std::uint64_t i = 0; i < 64 * static_cast<std::uint64_t>(PRIMORIAL); ++i) {
+            if (coprime((i + 1) % PRIMORIAL)) pattern_[i / 64] |= std::uint64_t(1) << (i % 64);
+        }
+    }
+
+    std::uint64_t operator()(std::uint64_t v) const {
+        return v / PRIMORIAL * counts_[PRIMORIAL - 1] + counts_[v % PRIMORIAL];
+    }
+
+    // Word of the pattern covering the numbers 64 * word + 1 .. 64 * word + 64.
+    std::uint64_t pattern_word(std::uint64_t word) const { return pattern_[word % PRIMORIAL]; }
+
+   private:
+    static bool coprime(std::uint32_t r) {
+        return r % 2 && r % 3 && r % 5 && r % 7 && r % 11 && r % 13;
+    }
+
+    std::vector<std::uint32_t> counts_;
+    std::vector<std::uint64_t> pattern_;
+};
+
+// Unsieved flags of one S2 segment, one bit per number. Leaves of one prime arrive with ascending
+// positions, so their counts come from a cursor that only moves forward over popcounted words,
+// and crossing off is a branch-free bit clear that keeps a running total.
+class SegmentBits {
+   public:
+    // Starts a segment of `size` numbers from low = 64 * k + 1 with the multiples of the first
+    // TinyPhi::C primes already gone.
+    void fill(std::uint64_t low, std::size_t size, const TinyPhi &tiny_phi) {
+        std::size_t words = (size + 63) / 64;
+        words_.resize(words);
+        unsieved_ = 0;
+        for (std::size_t w = 0; w < words; ++w) {
+            words_[w] = tiny_phi.pattern_word((low - 1) / 64 + w);
+            if (w == words - 1 && size % 64) words_[w] &= (std::uint64_t(1) << (size % 64)) - 1;
+            unsieved_ += __builtin_popcountll(words_[w]);
+        }
+    }
+
+    void clear(std::size_t pos) {
+        std::uint64_t &word = words_[pos / 64];
+        unsieved_ -= (word >> (pos % 64)) & 1;
+        word &= ~(std::uint64_t(1) << (pos % 64));
+    }
+
+    std::size_t unsieved() const { return unsieved_; }
+
+    // Restarts counting from position 0.
+    void rewind() {
+        cursor_ = 0;
+        counted_ = 0;
+    }
+
+    // Unsieved numbers at positions [0, pos]; pos must not decrease between rewind()s.
+    std::uint64_t count_to(std::size_t pos) {
+        std::size_t word = pos / 64;
+        for (; cursor_ < word; ++cursor_) counted_ += __builtin_popcountll(words_[cursor_]);
+        std::uint64_t mask = ~std::uint64_t(0) >> (63 - pos % 64);
+        return counted_ + __builtin_popcountll(words_[word] & mask);
+    }
+
+   private:
+    std::vector<std::uint64_t> words_;
+    std::size_t unsieved_ = 0;
+    std::size_t cursor_ = 0;      // Words before this one are in counted_
+    std::uint64_t counted_ = 0;
+};
+
+// Smallest prime factor and Moebius function of every n <= y. lpf(1) is treated as infinite.
+struct FactorTables {
+    std::vector<std::uint32_t> lpf;
+    std::vector<std::int8_t> mu;
+
+    explicit FactorTables(std::uint64_t y) : lpf(y + 1, 0), mu(y + 1, 1) {
+        for (std::uint64_t p = 2; p <= y; ++p) {
+            if (lpf[p] != 0) continue;  // Not prime
+            for (std::uint64_t n = p; n <= y; n += p) {
+                if (lpf[n] == 0) lpf[n] = static_cast<std::uint32_t>(p);
+                mu[n] = static_cast<std::int8_t>(-mu[n]);
+            }
+            if (p <= y / p) {
+                for (std::uint64_t n = p * p; n <= y; n += p * p) mu[n] = 0;
+            }
+        }
+        if (y >= 1) lpf[1] = std::numeric_limits<std::uint32_t>::max();
+    }
+};
+
+// One task's share of S2 over the sieve interval [first, last).
+struct SpecialLeaves {
+    std::int64_t sum = 0;
+    std::vector<std::int64_t> phi;     // Per b: unsieved numbers this task saw at stage b
+    std::vector<std::int64_t> mu_sum;  // Per b: sum of -mu(m) over this task's leaves
+};
+
+// primes is 1-indexed (primes[0] unused) and holds at least the primes <= y. first - 1 and
+// segment_size must be multiples of 64.
+inline SpecialLeaves special_leaves(std::uint64_t x, std::uint64_t y, std::uint64_t pi_y,
+                                    const std::vector<std::uint64_t> &primes,
+                                    const FactorTables &factors, const TinyPhi &tiny_phi,
+                                    std::uint64_t first, std::uint64_t last,
+                                    std::uint64_t segment_size) {
+    SpecialLeaves result;
+    result.phi.assign(pi_y + 1, 0);
+    result.mu_sum.assign(pi_y + 1, 0);
+
+    // Next odd multiple of each prime after the first c to cross off.
+    std::vector<std::uint64_t> next(pi_y + 1);
+    for (std::uint64_t b = TinyPhi::C + 1; b <= pi_y; ++b) {
+        std::uint64_t p = primes[b];
+        std::uint64_t k = std::max(p, (first + p - 1) / p * p);
+        if (k % 2 == 0) k += p;
+        next[b] = k;
+    }
+
+    SegmentBits bits;
+    for (std::uint64_t low = first; low < last; low += segment_size) {
+        std::uint64_t high = std::min(low + segment_size, last);
+        // Leaves phi(., b - 1) with b <= c are in S1, so the first c primes are only sieved,
+        // which the pattern the segment starts from already did.
+        bits.fill(low, static_cast<std::size_t>(high - low), tiny_phi);
+
+        for (std::uint64_t b = TinyPhi::C + 1; b < pi_y; ++b) {
+            std::uint64_t p = primes[b];
+            std::uint64_t min_m = std::max(x / (p * high), y / p);
+            std::uint64_t max_m = std::min(x / (p * low), y);
+            if (p >= max_m) break;  // No leaves for this or any larger b in later segments
+
+            bits.rewind();
+            for (std::uint64_t m = max_m; m > min_m; --m) {
+                if (factors.mu[m] != 0 && p < factors.lpf[m]) {
+                    std::int64_t count = bits.count_to(static_cast<std::size_t>(x / (p * m) - low));
+                    result.sum -= factors.mu[m] * (result.phi[b] + count);
+                    result.mu_sum[b] -= factors.mu[m];
+                }
+            }
+            result.phi[b] += bits.unsieved();
+
+            std::uint64_t k = next[b];
+            for (; k < high; k += 2 * p) bits.clear(static_cast<std::size_t>(k - low));
+            next[b] = k;
+        }
+    }
+    return result;
+}
+
+// pi(v) for every v in `values` (ascending), counted with one pass over [1, values.back()].
+inline std::vector<std::uint64_t> prime_pi_many(const std::vector<std::uint64_t> &values,
+                                                const std::vector<std::uint32_t> &base_primes,
+                                                WorkStealingPool &pool) {
+    std::vector<std::uint64_t> result(values.size());
+    if (values.empty()) return result;
+
+    std::uint64_t last = values.back();
+    std::size_t tasks = static_cast<std::size_t>(
+        std::min<std::uint64_t>(PRIME_PI_TASKS_PER_THREAD * pool.size(), last / (1 << 16) + 1));
+    std::vector<std::uint64_t> task_counts(tasks);
+    pool.run(tasks, [&](std::size_t task, int) {
+        std::uint64_t lo = last / tasks * task + 1;
+        std::uint64_t hi = task == tasks - 1 ? last : last / tasks * (task + 1);
+        std::size_t q = std::lower_bound(values.begin(), values.end(), lo) - values.begin();
+        std::uint64_t local = 0;
+        sieve_segments(lo, hi, base_primes, [&](const Wheel30Bitmap &segment) {
+            Wheel30View view = segment.view();
+            std::uint64_t cursor = std::max(lo, view.low());
+            std::uint64_t segment_end = std::min(hi, view.last());
+            for (; q < values.size() && values[q] <= segment_end; ++q) {
+                local += view.count(cursor, values[q]);
+                cursor = std::max(cursor, values[q] + 1);
+                result[q] = local;  // Relative to the task for now
+            }
+            local += view.count(cursor, segment_end);
+        });
+        task_counts[task] = local;
+    });
+
+    // Add the primes of earlier tasks, and 2, 3 and 5, which the wheel does not hold.
+    std::uint64_t before = 0;
+    std::size_t q = 0;
+    for (std::size_t task = 0; task < tasks; ++task) {
+        std::uint64_t hi = task == tasks - 1 ? last : last / tasks * (task + 1);
+        for (; q < values.size() && values[q] <= hi; ++q) {
+            std::uint64_t v = values[q];
+            result[q] += before + (v >= 2) + (v >= 3) + (v >= 5);
+        }
+        before += task_counts[task];
+    }
+    return result;
+}
+
+// Logarithmic integral li(x) for x > 1: gamma + ln ln x + sum (ln x)^n / (n * n!). Every term is
+// positive, so the series loses no precision to cancellation.
+inline long double log_integral(long double x) {
+    long double log_x = std::log(x);
+    long double sum = 0;
+    long double term = 1;
+    for (int n = 1; n < 1000; ++n) {
+        term *= log_x / n;
+        sum += term / n;
+        if (n > log_x && term / n < sum * 1e-19L) break;
+    }
+    return 0.5772156649015328606L + std::log(log_x) + sum;
+}
+
+// Riemann's R(x) = sum mu(k) / k * li(x^(1/k)), an estimate of pi(x) that is typically off by
+// less than sqrt(x) / ln(x).
+inline long double riemann_r(long double x) {
+    if (x < 2) return 0;
+    long double sum = 0;
+    for (int k = 1;; ++k) {
+        long double root = std::pow(x, 1.0L / k);
+        if (root < 2) break;
+        int mu = 1;  // Moebius function of k
+        for (int n = k, d = 2; n > 1; ++d) {
+            if (n % d != 0) continue;
+            n /= d;
+            if (n % d == 0) {
+                mu = 0;
+                break;
+            }
+            mu = -mu;
+        }
+        if (mu != 0) sum += mu * log_integral(root) / k;
+    }
+    return sum;
+}
+
+// The x with R(x) = n, by Newton's method (R'(x) is about 1 / ln x): an estimate of the n-th prime,
+// or, for n = R(a - 1) + k, of the k-th prime from a.
+inline std::uint64_t riemann_r_inverse(long double n) {
+    if (n < 1) return 2;
+    long double x = std::max(2.0L, n * std::log(std::max(n, 2.0L)));
+    for (int i = 0; i < 100; ++i) {
+        long double next = std::max(2.0L, x - (riemann_r(x) - n) * std::log(x));
+        bool done = std::fabs(next - x) < 0.5L;
+        x = next;
+        if (done) break;
+    }
+    if (x >= 18446744073709551615.0L) return std::numeric_limits<std::uint64_t>::max();
+    return static_cast<std::uint64_t>(x);
+}
+
+// Whether pi(b) - pi(a - 1) beats sieving [a, b]. Measured on one core, LMO takes about
+// 3e-9 * x^(2/3) s against 1.6e-9 s per sieved number, and both spread over the pool alike.
+inline bool prime_pi_pays_off(std::uint64_t a, std::uint64_t b) {
+    if (b < PRIME_PI_MIN || b >= PRIME_PI_MAX) return false;
+    std::uint64_t b13 = icbrt(b);
+    return b - a >= PRIME_PI_MIN && b - a > 4 * b13 * b13;
+}
+
+// Number of primes <= x. Uses `pool` for the special leaves and P2.
+inline std::uint64_t prime_pi(std::uint64_t x, WorkStealingPool &pool) {
+    if (x < PRIME_PI_MIN || x >= PRIME_PI_MAX) {
+        return segmented_count(0, x, generate_primes(static_cast<std::uint32_t>(isqrt(x))));
+    }
+
+    // alpha trades the S2 sieve interval x / y against the number of leaves. ln(x)^2 / 450 was
+    // the measured optimum from 1e10 (alpha 1) to 1e14 (alpha ~2.3).
+    double log_x = std::log(static_cast<double>(x));
+    double alpha = std::max(1.0, log_x * log_x / 450);
+    std::uint64_t x13 = icbrt(x);
+    std::uint64_t sqrt_x = isqrt(x);
+    std::uint64_t y = std::min(static_cast<std::uint64_t>(x13 * alpha), sqrt_x - 1);
+    y = std::max(y, x13);
+
+    std::vector<std::uint32_t> small_primes = generate_primes(static_cast<std::uint32_t>(sqrt_x));
+    std::vector<std::uint64_t> primes(1, 0);  // 1-indexed
+    primes.insert(primes.end(), small_primes.begin(), small_primes.end());
+    std::uint64_t pi_y = std::upper_bound(primes.begin() + 1, primes.end(), y) - primes.begin() - 1;
+    std::uint64_t pi_sqrt_x = primes.size() - 1;
+
+    FactorTables factors(y);
+    TinyPhi tiny_phi;
+
+    // S1: ordinary leaves n <= y with every prime factor above p_c.
+    std::int64_t s1 = 0;
+    for (std::uint64_t n = 1; n <= y; ++n) {
+        if (factors.mu[n] != 0 && factors.lpf[n] > primes[TinyPhi::C]) {
+            s1 += factors.mu[n] * static_cast<std::int64_t>(tiny_phi(x / n));
+        }
+    }
+
+    // S2: special leaves, one task per block of segments of [1, x / y].
+    std::uint64_t limit = x / y + 1;
+    std::uint64_t segment_size = 1 << 14;
+    while (segment_size * segment_size < limit) segment_size *= 2;
+    std::uint64_t segments = (limit - 1 + segment_size - 1) / segment_size;
+    std::size_t tasks = static_cast<std::size_t>(
+        std::min<std::uint64_t>(PRIME_PI_TASKS_PER_THREAD * pool.size(), segments));
+    std::vector<SpecialLeaves> leaves(tasks);
+    pool.run(tasks, [&](std::size_t task, int) {
+        std::uint64_t first = 1 + segments * task / tasks * segment_size;
+        std::uint64_t last = std::min(limit, 1 + segments * (task + 1) / tasks * segment_size);
+        leaves[task] =
+            special_leaves(x, y, pi_y, primes, factors, tiny_phi, first, last, segment_size);
+    });
+    std::int64_t s2 = 0;
+    std::vector<std::int64_t> phi_before(pi_y + 1, 0);
+    for (const SpecialLeaves &task : leaves) {
+        s2 += task.sum;
+        for (std::uint64_t b = 1; b <= pi_y; ++b) {
+            s2 += phi_before[b] * task.mu_sum[b];
+            phi_before[b] += task.phi[b];
+        }
+    }
+
+    // P2: sum over y < p_k <= sqrt(x) of pi(x / p_k) - (k - 1).
+    std::vector<std::uint64_t> quotients;
+    for (std::uint64_t k = pi_sqrt_x; k > pi_y; --k) quotients.push_back(x / primes[k]);
+    std::vector<std::uint64_t> pi_quotients = prime_pi_many(quotients, small_primes, pool);
+    std::int64_t p2 = 0;
+    for (std::size_t i = 0; i < quotients.size(); ++i) {
+        std::uint64_t k = pi_sqrt_x - i;
+        p2 += static_cast<std::int64_t>(pi_quotients[i]) - static_cast<std::int64_t>(k - 1);
+    }
+
+    std::int64_t phi = s1 + s2;
+    return static_cast<std::uint64_t>(phi + static_cast<std::int64_t>(pi_y) - 1 - p2);
+}
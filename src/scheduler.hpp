@@ -0,0 +1,224 @@
+#pragma once
+
+#include <sched.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "topology.hpp"
+
+// Per-worker counters, accumulated over every run() of a pool.
+struct WorkerStats {
+    std::thread::id id;
+    double busy_ms = 0;
+    std::uint64_t tasks = 0;
+    std::uint64_t steals = 0;
+    int cpu = -1;  // CPU the worker last ran on
+};
+
+// Persistent set of worker threads that execute batches of indexed tasks. run() deals the task
+// indices out to per-worker deques in contiguous blocks; each worker pops its own deque from the
+// front and, once empty, steals from the back of the others. Uneven task costs (trial division
+// gets slower as n grows) are therefore absorbed by whichever workers run out first.
+//
+// Given cpus (see plan_worker_cpus()), worker i pins itself to cpus[i] before it allocates
+// anything, so the segment buffers it sieves in end up on its own NUMA node.
+class WorkStealingPool {
+   public:
+    explicit WorkStealingPool(int workers, std::vector<int> cpus = {})
+        : queues_(workers), stats_(workers), cpus_(std::move(cpus)) {
+        for (int i = 0; i < workers; ++i) {
+            queues_[i] = std::make_unique<TaskQueue>();
+        }
+        for (int i = 0; i < workers; ++i) {
+            threads_.emplace_back(&WorkStealingPool::worker_loop, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (auto &t : threads_) {
+            t.join();
+        }
+    }
+
+    WorkStealingPool(const WorkStealingPool &) = delete;
+    WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+    int size() const { return static_cast<int>(threads_.size()); }
+    const std::vector<WorkerStats> &stats() const { return stats_; }
+
+    // Calls job(task, worker) for every task in [0, tasks) and returns once all of them finished.
+    void run(std::size_t tasks, const std::function<void(std::size_t, int)> &job) {
+        std::size_t workers = queues_.size();
+        for (std::size_t w = 0; w < workers; ++w) {
+            std::size_t first = tasks * w / workers;
+            std::size_t last = tasks * (w + 1) / workers;
+            std::lock_guard<std::mutex> lock(queues_[w]->mutex);
+            for (std::size_t task = first; task < last; ++task) {
+                queues_[w]->tasks.push_back(task);
+            }
+        }
+
+        std::unique_lock<std::mutex> lock(mutex_);
+        job_ = &job;
+        active_ = static_cast<int>(workers);
+        ++generation_;
+        wake_.notify_all();
+        done_.wait(lock, [this] { return active_ == 0; });
+        job_ = nullptr;
+    }
+
+   private:
+    struct TaskQueue {
+        std::deque<std::size_t> tasks;
+        std::mutex mutex;
+    };
+
+    bool pop_local(int self, std::size_t &task) {
+        TaskQueue &queue = *queues_[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) return false;
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        return true;
+    }
+
+    bool steal(int self, std::size_t &task) {
+        int workers = static_cast<int>(queues_.size());
+        for (int k = 1; k < workers; ++k) {
+            TaskQueue &victim = *queues_[(self + k) % workers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.tasks.empty()) continue;
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    void worker_loop(int self) {
+        if (static_cast<std::size_t>(self) < cpus_.size()) pin_current_thread(cpus_[self]);
+        std::uint64_t seen_generation = 0;
+        for (;;) {
+            const std::function<void(std::size_t, int)> *job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return stop_ || generation_ != seen_generation; });
+                if (stop_) return;
+                seen_generation = generation_;
+                job = job_;
+            }
+
+            WorkerStats stats;
+            auto start_time = std::chrono::high_resolution_clock::now();
+            std::size_t task;
+            for (;;) {
+                if (pop_local(self, task)) {
+                    (*job)(task, self);
+                } else if (steal(self, task)) {
+                    ++stats.steals;
+                    (*job)(task, self);
+                } else {
+                    break;
+                }
+                ++stats.tasks;
+            }
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::high_resolution_clock::now() - start_time;
+            stats.busy_ms = elapsed.count();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            stats_[self].id = std::this_thread::get_id();
+            stats_[self].busy_ms += stats.busy_ms;
+            stats_[self].tasks += stats.tasks;
+            stats_[self].steals += stats.steals;
+            stats_[self].cpu = sched_getcpu();
+            if (--active_ == 0) done_.notify_all();
+        }
+    }
+
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<WorkerStats> stats_;
+    std::vector<int> cpus_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t, int)> *job_ = nullptr;
+    std::uint64_t generation_ = 0;
+    int active_ = 0;
+    bool stop_ = false;
+};
+
+// Hands task indices out in increasing order to any number of producer threads and gives the
+// results back to a single consumer in the same order. At most `window` tasks can be in flight or
+// finished-but-not-taken at once: acquire() blocks producers that run too far ahead, so memory
+// stays bounded by the window no matter how many tasks there are. When the number of tasks is not
+// known up front, pass SIZE_MAX and call end_at() once it is.
+template <typename R>
+class ReorderWindow {
+   public:
+    ReorderWindow(std::size_t tasks, std::size_t window) : tasks_(tasks), slots_(window) {}
+
+    // Claims the next task index. Returns false once every task has been claimed.
+    bool acquire(std::size_t &task) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (next_task_ >= tasks_) return false;
+        task = next_task_++;
+        space_.wait(lock, [&] { return task < taken_ + slots_.size(); });
+        return true;
+    }
+
+    void publish(std::size_t task, R result) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        slots_[task % slots_.size()] = std::move(result);
+        ready_.notify_all();
+    }
+
+    // Ends the sequence at `tasks` tasks. Task index `tasks`, if claimed, is never published.
+    void end_at(std::size_t tasks) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        tasks_ = tasks;
+        ready_.notify_all();
+    }
+
+    // Waits for the next result in task order. Returns false once every result has been taken.
+    bool take(R &result) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (taken_ == tasks_) return false;
+        std::optional<R> &slot = slots_[taken_ % slots_.size()];
+        ready_.wait(lock, [&] { return slot.has_value() || taken_ == tasks_; });
+        if (!slot.has_value()) return false;
+        result = std::move(*slot);
+        slot.reset();
+        ++taken_;
+        space_.notify_all();
+        return true;
+    }
+
+   private:
+    std::size_t tasks_;
+    std::vector<std::optional<R>> slots_;
+    std::size_t next_task_ = 0;
+    std::size_t taken_ = 0;
+
+    std::mutex mutex_;
+    std::condition_variable space_;
+    std::condition_variable ready_;
+};
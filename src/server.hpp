@@ -0,0 +1,109 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+
+// Line-oriented request server on a Unix domain socket. Every connection is served by a thread
+// of its own; each request line is passed to the handler and its reply is sent back followed by
+// '\n', so clients can pipeline requests. Whatever the handler keeps resident (base primes, a
+// thread pool, cached blocks) is shared by all connections.
+class QueryServer {
+   public:
+    static constexpr std::size_t MAX_REQUEST = 4096;  // Longer lines close the connection
+
+    using Handler = std::function<std::string(const std::string &)>;
+
+    // Binds and listens on path, replacing a stale socket file. Throws std::runtime_error.
+    QueryServer(const std::string &path, Handler handler)
+        : path_(path), handler_(std::move(handler)) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path is too long: " + path);
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ < 0) throw std::runtime_error(std::string("socket: ") + std::strerror(errno));
+        ::unlink(path.c_str());
+        if (::bind(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+            ::listen(fd_, SOMAXCONN) != 0) {
+            std::string error = std::strerror(errno);
+            ::close(fd_);
+            throw std::runtime_error("Cannot listen on " + path + ": " + error);
+        }
+    }
+
+    ~QueryServer() {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+
+    QueryServer(const QueryServer &) = delete;
+    QueryServer &operator=(const QueryServer &) = delete;
+
+    // Accepts connections until accept() fails for a reason other than EINTR.
+    void serve() {
+        for (;;) {
+            int client = ::accept(fd_, nullptr, nullptr);
+            if (client < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                return;
+            }
+            std::thread(&QueryServer::handle_connection, this, client).detach();
+        }
+    }
+
+   private:
+    void handle_connection(int client) {
+        std::string pending;
+        char buffer[4096];
+        for (;;) {
+            ssize_t received = ::read(client, buffer, sizeof(buffer));
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) break;
+            pending.append(buffer, static_cast<std::size_t>(received));
+
+            std::string replies;
+            std::size_t line_start = 0;
+            for (std::size_t newline; (newline = pending.find('\n', line_start)) !=
+                                      std::string::npos;
+                 line_start = newline + 1) {
+                std::string line = pending.substr(line_start, newline - line_start);
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                replies += handler_(line);
+                replies += '\n';
+            }
+            pending.erase(0, line_start);
+            if (!send_all(client, replies) || pending.size() > MAX_REQUEST) break;
+        }
+        ::close(client);
+    }
+
+    static bool send_all(int client, const std::string &data) {
+        const char *p = data.data();
+        std::size_t left = data.size();
+        while (left > 0) {
+            ssize_t sent = ::send(client, p, left, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) return false;
+            p += sent;
+            left -= static_cast<std::size_t>(sent);
+        }
+        return true;
+    }
+
+    std::string path_;
+    Handler handler_;
+    int fd_ = -1;
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "wheel.hpp"
+
+// Data cache sizes of the host in bytes, 0 where unknown. sysconf() answers on glibc; elsewhere
+// the cpu0 entries under /sys/devices/system/cpu are read instead.
+struct DataCaches {
+    std::size_t l1d = 0;
+    std::size_t l2 = 0;
+};
+
+inline const DataCaches &data_caches() {
+    static const DataCaches caches = [] {
+        DataCaches found;
+#if defined(_SC_LEVEL1_DCACHE_SIZE) && defined(_SC_LEVEL2_CACHE_SIZE)
+        found.l1d = static_cast<std::size_t>(std::max(0L, sysconf(_SC_LEVEL1_DCACHE_SIZE)));
+        found.l2 = static_cast<std::size_t>(std::max(0L, sysconf(_SC_LEVEL2_CACHE_SIZE)));
+#endif
+        for (int index = 0; index < 8 && (found.l1d == 0 || found.l2 == 0); ++index) {
+            std::string dir = "/sys/devices/system/cpu/cpu0/cache/index" + std::to_string(index);
+            int level = 0;
+            std::string type, size;
+            std::ifstream(dir + "/level") >> level;
+            std::ifstream(dir + "/type") >> type;
+            std::ifstream(dir + "/size") >> size;  // "48K", "2048K", "1M"
+            if (size.empty() || type == "Instruction") continue;
+            std::size_t bytes = std::strtoull(size.c_str(), nullptr, 10);
+            bytes <<= size.back() == 'K' ? 10 : size.back() == 'M' ? 20 : 0;
+            if (level == 1 && found.l1d == 0) found.l1d = bytes;
+            if (level == 2 && found.l2 == 0) found.l2 = bytes;
+        }
+        return found;
+    }();
+    return caches;
+}
+
+// Limits of -segment-size. Segments above the largest would overflow the offsets SievingPrimes
+// packs into its buckets.
+constexpr std::size_t SIEVE_SEGMENT_MIN_BYTES = 1 << 10;
+constexpr std::size_t SIEVE_SEGMENT_MAX_BYTES = 1 << 24;
+
+inline std::size_t &sieve_segment_setting() {
+    static std::size_t bytes = [] {
+        const DataCaches &caches = data_caches();
+        std::size_t l2 = caches.l2 ? caches.l2 : 1 << 20;
+        return std::clamp(l2 / 4, SIEVE_SEGMENT_MIN_BYTES, SIEVE_SEGMENT_MAX_BYTES);
+    }();
+    return bytes;
+}
+
+// Bytes per wheel segment (30 integers per byte): a quarter of L2 unless
+// set_sieve_segment_bytes() overrides it. That leaves L2 room for the buckets and for a sibling
+// hyperthread, and makes segments long enough that the medium primes, which are walked once per
+// segment, are mostly walked for their hits.
+inline std::size_t sieve_segment_bytes() { return sieve_segment_setting(); }
+
+// Makes every later sieve use segments of this many bytes. False if it is out of range. Must be
+// called before any sieving starts.
+inline bool set_sieve_segment_bytes(std::size_t bytes) {
+    if (bytes < SIEVE_SEGMENT_MIN_BYTES || bytes > SIEVE_SEGMENT_MAX_BYTES) return false;
+    sieve_segment_setting() = bytes;
+    return true;
+}
+
+// Bytes of a segment that the pattern primes are ANDed into at a time: half of L1d, so that the
+// block and the patterns both stay there.
+inline std::size_t sieve_block_bytes() {
+    static const std::size_t bytes = [] {
+        const DataCaches &caches = data_caches();
+        std::size_t l1d = caches.l1d ? caches.l1d : 32 << 10;
+        return std::max<std::size_t>(l1d / 2, 4 << 10);
+    }();
+    return bytes;
+}
+
+// floor(sqrt(n)) without overflowing near 2^64.
+inline std::uint64_t isqrt(std::uint64_t n) {
+    std::uint64_t r = static_cast<std::uint64_t>(std::sqrt(static_cast<double>(n)));
+    while (r > 0 && r > n / r) --r;
+    while (r + 1 <= n / (r + 1)) ++r;
+    return r;
+}
+
+// Returns all primes <= limit using a plain sieve of Eratosthenes. Only meant for small limits;
+// generate_primes() builds on it for anything larger.
+inline std::vector<std::uint32_t> simple_sieve(std::uint32_t limit) {
+    std::vector<std::uint32_t> result;
+    if (limit < 2) return result;
+
+    std::vector<bool> composite(static_cast<std::size_t>(limit) + 1, false);
+    for (std::uint64_t i = 2; i <= limit; ++i) {
+        if (composite[i]) continue;
+        result.push_back(static_cast<std::uint32_t>(i));
+        for (std::uint64_t j = i * i; j <= limit; j += i) {
+            composite[j] = true;
+        }
+    }
+    return result;
+}
+
+// Base primes above the sieve kernel's pattern_limit, crossed off the consecutive segments of one
+// sieve_segments() call. Each prime costs one division, when the segment holding its square (or
+// the first segment) is reached; after that only its hits cost anything:
+//  - medium primes, up to a segment span, hit every segment and keep the offset of their next
+//    multiple from segment to segment;
+//  - large primes hit few segments, so each one waits in the bucket of the segment holding its
+//    next multiple and is only touched when that segment is sieved. Far from zero almost all base
+//    primes are large and most segments are never hit by a given one.
+class SievingPrimes {
+   public:
+    // Segments start at low, a multiple of 30, and run up to end.
+    SievingPrimes(const std::vector<std::uint32_t> &base_primes, std::uint32_t pattern_limit,
+                  std::uint64_t low, std::uint64_t end)
+        : base_primes_(base_primes),
+          span_(30 * static_cast<std::uint64_t>(sieve_segment_bytes())),
+          last_segment_((end - low) / span_) {
+        sqrt_end_ = isqrt(end);
+        next_ = static_cast<std::size_t>(
+            std::upper_bound(base_primes.begin(), base_primes.end(), pattern_limit) -
+            base_primes.begin());
+        // A large prime's next multiple is at most 6p past its current one, and its first one at
+        // most 7p past the start of the first segment it enters.
+        buckets_.resize(static_cast<std::size_t>(
+            std::min<std::uint64_t>(7 * sqrt_end_ / span_ + 2, last_segment_ + 1)));
+    }
+
+    // Crosses the primes off the next segment, which must be sieve_segment_bytes() long except
+    // for the last.
+    void cross_off(Wheel30Bitmap &segment) {
+        for (; next_ < base_primes_.size(); ++next_) {
+            std::uint64_t p = base_primes_[next_];
+            if (p > sqrt_end_ || p * p > segment.last()) break;
+            std::uint64_t offset;
+            unsigned w;
+            if (!segment.first_multiple(p, offset, w)) continue;
+            if (p <= span_) {
+                medium_.push_back({static_cast<std::uint32_t>(p), w, offset});
+            } else {
+                file(static_cast<std::uint32_t>(p), offset, w);
+            }
+        }
+
+        std::uint64_t span = 30 * static_cast<std::uint64_t>(segment.size());
+        for (MediumPrime &m : medium_) {
+            m.offset = segment.cross_off_from(m.prime, m.offset, m.wheel) - span;
+        }
+
+        std::vector<LargePrime> &bucket = buckets_[segment_ % buckets_.size()];
+        for (const LargePrime &l : bucket) {
+            std::uint64_t offset = l.offset_and_wheel >> 3;
+            if (offset >= span) continue;  // Past end in the last, shorter segment
+            segment.cross_off_at(offset);
+            unsigned w = l.offset_and_wheel & 7;
+            file(l.prime, offset + static_cast<std::uint64_t>(l.prime) * WHEEL30_GAPS[w], w + 1);
+        }
+        bucket.clear();
+        ++segment_;
+    }
+
+   private:
+    struct MediumPrime {
+        std::uint32_t prime;
+        unsigned wheel;
+        std::uint64_t offset;  // From the current segment's low
+    };
+
+    // 8 bytes, so that the buckets stay small even with every prime below 2^32 in them.
+    struct LargePrime {
+        std::uint32_t prime;
+        std::uint32_t offset_and_wheel;  // Offset within its segment << 3 | cofactor wheel index
+    };
+
+    // Files a large prime whose next multiple is `offset` from the current segment's low into
+    // that multiple's bucket, or drops it if the multiple is past the last segment.
+    void file(std::uint32_t p, std::uint64_t offset, unsigned w) {
+        std::uint64_t segment = segment_ + offset / span_;
+        if (segment > last_segment_) return;
+        buckets_[segment % buckets_.size()].push_back(
+            {p, static_cast<std::uint32_t>(offset % span_ << 3 | (w & 7))});
+    }
+
+    const std::vector<std::uint32_t> &base_primes_;
+    std::uint64_t span_;         // Numbers per full segment
+    std::size_t next_;           // First base prime not handed to a tier yet
+    std::uint64_t sqrt_end_;     // Larger primes have no multiple to cross off
+    std::uint64_t segment_ = 0;  // Index of the segment cross_off() sieves next
+    std::uint64_t last_segment_;
+    std::vector<MediumPrime> medium_;
+    std::vector<std::vector<LargePrime>> buckets_;  // Ring indexed by segment number
+};
+
+// Sieves [start, end] in sieve_segment_bytes()-sized wheel segments and calls
+// on_segment(segment) once per segment with every composite crossed off. Each segment starts from
+// the pre-sieve pattern, the sieve kernel ANDs in the patterns of the primes up to its
+// pattern_limit one L1d-sized block at a time, and SievingPrimes crosses off the rest.
+// base_primes must contain every prime <= sqrt(end). Memory use does not depend on the width of
+// the range.
+template <typename Fn>
+void sieve_segments(std::uint64_t start, std::uint64_t end,
+                    const std::vector<std::uint32_t> &base_primes, Fn on_segment) {
+    const std::size_t segment_bytes = sieve_segment_bytes();
+    const std::size_t block_bytes = sieve_block_bytes();
+    const std::uint64_t span = 30 * static_cast<std::uint64_t>(segment_bytes);
+    // Kept by each thread across calls, so a pinned worker allocates (and first touches) it once,
+    // on its own NUMA node.
+    thread_local Wheel30Bitmap segment;
+    const SieveKernel &kernel = sieve_kernel();
+    SievingPrimes sieving_primes(base_primes, kernel.pattern_limit, start / 30 * 30, end);
+    for (std::uint64_t low = start / 30 * 30;; low += span) {
+        std::size_t bytes = static_cast<std::size_t>(
+            std::min<std::uint64_t>(segment_bytes, (end - low) / 30 + 1));
+        segment.reset_presieved(low, bytes);
+        segment.clear_pattern_primes(kernel, block_bytes);
+        sieving_primes.cross_off(segment);
+        on_segment(segment);
+        if (end - low < span) break;
+    }
+}
+
+// Appends the primes in [start, end] to out, in ascending order. for_each_segment(fn) must call
+// fn(view) with sieved Wheel30Views covering [start, end] in ascending order; they may come from
+// sieve_segments() or from a SieveCache.
+template <typename T, typename Segments>
+void primes_from_segments(T start, T end, Segments for_each_segment, std::vector<T> &out) {
+    if (end < 2 || start > end) return;
+    for (T small : {T(2), T(3), T(5)}) {
+        if (start <= small && small <= end) out.push_back(small);
+    }
+    for_each_segment([&](const Wheel30View &segment) { segment.extract(start, end, out); });
+}
+
+// Number of primes in [start, end], counted with popcount over segments as above.
+template <typename Segments>
+std::uint64_t count_from_segments(std::uint64_t start, std::uint64_t end,
+                                  Segments for_each_segment) {
+    if (end < 2 || start > end) return 0;
+    std::uint64_t count = 0;
+    for (std::uint64_t small : {2, 3, 5}) {
+        if (start <= small && small <= end) ++count;
+    }
+    for_each_segment([&](const Wheel30View &segment) { count += segment.count(start, end); });
+    return count;
+}
+
+// Appends the primes in [start, end] to out, in ascending order.
+template <typename T>
+void segmented_sieve(T start, T end, const std::vector<std::uint32_t> &base_primes,
+                     std::vector<T> &out) {
+    primes_from_segments(start, end, [&](auto on_view) {
+        sieve_segments(start, end, base_primes,
+                       [&](const Wheel30Bitmap &segment) { on_view(segment.view()); });
+    }, out);
+}
+
+// Number of primes in [start, end], counted with popcount over the sieved segments.
+inline std::uint64_t segmented_count(std::uint64_t start, std::uint64_t end,
+                                     const std::vector<std::uint32_t> &base_primes) {
+    return count_from_segments(start, end, [&](auto on_view) {
+        sieve_segments(start, end, base_primes,
+                       [&](const Wheel30Bitmap &segment) { on_view(segment.view()); });
+    });
+}
+
+// Returns all primes <= limit (limit < 2^32), sieving with the primes up to sqrt(limit).
+inline std::vector<std::uint32_t> generate_primes(std::uint32_t limit) {
+    std::vector<std::uint32_t> result;
+    segmented_sieve<std::uint32_t>(2, limit, simple_sieve(static_cast<std::uint32_t>(isqrt(limit))),
+                                   result);
+    return result;
+}
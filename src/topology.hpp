@@ -0,0 +1,124 @@
+#pragma once
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Worker placement for -affinity.
+enum class Affinity { none, compact, scatter };
+
+// One logical CPU the process may run on, as described under /sys/devices/system/cpu.
+struct CpuInfo {
+    int cpu;
+    int package;    // Socket
+    int core;       // core_id, unique within its package only
+    int node;       // NUMA node, 0 if the kernel lists none
+    int sibling;    // Rank among the SMT siblings of its core, 0 for the first
+    int core_rank;  // Rank of its core among the cores of its node and package
+};
+
+// The CPUs in the process's affinity mask (so taskset and cpusets are honoured), in CPU order.
+// Read once.
+inline const std::vector<CpuInfo> &cpu_topology() {
+    static const std::vector<CpuInfo> cpus = [] {
+        std::vector<CpuInfo> found;
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return found;
+
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (!CPU_ISSET(cpu, &allowed)) continue;
+            std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+            CpuInfo info{cpu, 0, cpu, 0, 0, 0};
+            std::ifstream(dir + "/topology/physical_package_id") >> info.package;
+            std::ifstream(dir + "/topology/core_id") >> info.core;
+            if (DIR *entries = opendir(dir.c_str())) {
+                while (struct dirent *e = readdir(entries)) {
+                    std::string name = e->d_name;
+                    if (name.compare(0, 4, "node") == 0 && name.size() > 4) {
+                        info.node = std::atoi(name.c_str() + 4);
+                    }
+                }
+                closedir(entries);
+            }
+            found.push_back(info);
+        }
+
+        // CPUs come in increasing order, so siblings and cores are ranked by their lowest CPU.
+        std::map<std::tuple<int, int, int>, std::pair<int, int>> cores;  // -> (rank, siblings)
+        std::map<std::pair<int, int>, int> cores_per_node;
+        for (CpuInfo &info : found) {
+            int &count = cores_per_node[{info.node, info.package}];
+            auto [core, added] = cores.try_emplace({info.node, info.package, info.core}, count, 0);
+            if (added) ++count;
+            info.core_rank = core->second.first;
+            info.sibling = core->second.second++;
+        }
+        return found;
+    }();
+    return cpus;
+}
+
+// Topology entry of cpu, or nullptr if the process may not run there.
+inline const CpuInfo *cpu_info(int cpu) {
+    for (const CpuInfo &info : cpu_topology()) {
+        if (info.cpu == cpu) return &info;
+    }
+    return nullptr;
+}
+
+inline int physical_core_count() {
+    int cores = 0;
+    for (const CpuInfo &info : cpu_topology()) cores += info.sibling == 0;
+    return cores;
+}
+
+// CPU for each of `workers` workers; empty for Affinity::none. compact fills all SMT siblings of
+// a core, then the next core of the same node, so that workers share caches. scatter gives every
+// physical core one worker, alternating between nodes and packages, before any core gets a second
+// one, so that workers get as much cache and memory bandwidth each as possible. With
+// physical_cores_only, only the first sibling of each core is used. Workers beyond the CPUs wrap
+// around.
+inline std::vector<int> plan_worker_cpus(Affinity affinity, int workers,
+                                         bool physical_cores_only) {
+    std::vector<CpuInfo> order;
+    for (const CpuInfo &info : cpu_topology()) {
+        if (!physical_cores_only || info.sibling == 0) order.push_back(info);
+    }
+    if (affinity == Affinity::none || order.empty()) return {};
+
+    auto compact_key = [](const CpuInfo &c) {
+        return std::make_tuple(c.node, c.package, c.core_rank, c.sibling);
+    };
+    auto scatter_key = [](const CpuInfo &c) {
+        return std::make_tuple(c.sibling, c.core_rank, c.node, c.package);
+    };
+    std::stable_sort(order.begin(), order.end(), [&](const CpuInfo &x, const CpuInfo &y) {
+        return affinity == Affinity::compact ? compact_key(x) < compact_key(y)
+                                             : scatter_key(x) < scatter_key(y);
+    });
+
+    std::vector<int> cpus(workers);
+    for (int w = 0; w < workers; ++w) {
+        cpus[w] = order[w % order.size()].cpu;
+    }
+    return cpus;
+}
+
+// Pins the calling thread to cpu. Under the kernel's default first-touch policy, the pages the
+// thread touches first from then on are placed on cpu's NUMA node.
+inline bool pin_current_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
@@ -0,0 +1,312 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "kernels.hpp"
+
+// Mod-30 wheel layout: byte i of a bitmap starting at `low` (a multiple of 30) holds the eight
+// numbers low + 30 * i + WHEEL30_RESIDUES[k], k = 0..7, which are the only residues mod 30 that
+// are coprime to 2, 3 and 5. A byte therefore covers 30 integers, 15x denser than a byte per
+// integer.
+constexpr std::uint8_t WHEEL30_RESIDUES[8] = {1, 7, 11, 13, 17, 19, 23, 29};
+
+// Distance from a residue's wheel position to the next one (29 -> 31 wraps to the next byte).
+constexpr std::uint8_t WHEEL30_GAPS[8] = {6, 4, 2, 4, 2, 4, 6, 2};
+
+// Bit index of each residue mod 30, or 8 when the residue is not on the wheel.
+constexpr std::uint8_t WHEEL30_BIT[30] = {8, 0, 8, 8, 8, 8, 8, 1, 8, 8, 8, 2, 8, 3, 8,
+                                          8, 8, 4, 8, 5, 8, 8, 8, 6, 8, 8, 8, 8, 8, 7};
+
+// Offset from a residue mod 30 to the next residue that is on the wheel (0 if already on it).
+constexpr std::uint8_t WHEEL30_ADVANCE[30] = {1, 0, 5, 4, 3, 2, 1, 0, 3, 2, 1, 0, 1, 0, 3,
+                                              2, 1, 0, 1, 0, 3, 2, 1, 0, 5, 4, 3, 2, 1, 0};
+
+// Bits of a byte that stand for numbers >= low + 30 * i + r, indexed by r in [0, 30].
+inline std::uint8_t wheel30_mask_from(unsigned r) {
+    std::uint8_t mask = 0;
+    for (unsigned k = 0; k < 8; ++k) {
+        if (WHEEL30_RESIDUES[k] >= r) mask |= static_cast<std::uint8_t>(1u << k);
+    }
+    return mask;
+}
+
+// Multiples of the primes 7 .. WHEEL30_PRESIEVE_LARGEST fall on the same wheel bits every
+// WHEEL30_PRESIEVE_PERIOD bytes, so segments start from a copy of that pattern instead of
+// crossing those primes off. Small primes are the costliest to cross off: these five alone
+// clear 36% of the wheel bits and account for about a quarter of all crossing-off writes.
+constexpr std::uint32_t WHEEL30_PRESIEVE_LARGEST = 19;
+constexpr std::size_t WHEEL30_PRESIEVE_PERIOD = 7 * 11 * 13 * 17 * 19;  // 316 KiB
+
+// Wheel bytes of [0, 30 * WHEEL30_PRESIEVE_PERIOD) with every multiple of 7, 11, 13, 17 and 19
+// cleared, built on first use. Byte i of any wheel bitmap starting at 0 equals
+// pattern[i % WHEEL30_PRESIEVE_PERIOD] after pre-sieving.
+inline const std::vector<std::uint8_t> &wheel30_presieve_pattern() {
+    static const std::vector<std::uint8_t> pattern = [] {
+        std::vector<std::uint8_t> bytes(WHEEL30_PRESIEVE_PERIOD, 0xff);
+        for (unsigned p : {7u, 11u, 13u, 17u, 19u}) {
+            std::uint8_t period[WHEEL30_PRESIEVE_LARGEST];  // p's own pattern repeats every p bytes
+            for (unsigned i = 0; i < p; ++i) {
+                period[i] = 0xff;
+                for (unsigned k = 0; k < 8; ++k) {
+                    if ((30 * i + WHEEL30_RESIDUES[k]) % p == 0) {
+                        period[i] &= static_cast<std::uint8_t>(~(1u << k));
+                    }
+                }
+            }
+            for (std::size_t i = 0, j = 0; i < bytes.size(); ++i) {
+                bytes[i] &= period[j];
+                if (++j == p) j = 0;
+            }
+        }
+        return bytes;
+    }();
+    return pattern;
+}
+
+// Wheel bytes of one prime p from 23 up to the largest SieveKernel::pattern_limit, with the
+// multiples of p cleared. They repeat every p bytes; SIEVE_KERNEL_PATTERN_PADDING more bytes
+// follow so that and_pattern() can load whole blocks from any phase.
+struct Wheel30PrimePattern {
+    std::uint32_t prime;
+    std::vector<std::uint8_t> bytes;
+};
+
+inline const std::vector<Wheel30PrimePattern> &wheel30_prime_patterns() {
+    static const std::vector<Wheel30PrimePattern> patterns = [] {
+        std::uint32_t limit = 0;
+        for (const SieveKernel &kernel : SIEVE_KERNELS) {
+            limit = std::max(limit, kernel.pattern_limit);
+        }
+        std::vector<Wheel30PrimePattern> result;
+        for (std::uint32_t p = WHEEL30_PRESIEVE_LARGEST + 1; p <= limit; ++p) {
+            bool prime = true;
+            for (std::uint32_t d = 2; d * d <= p; ++d) prime = prime && p % d != 0;
+            if (!prime) continue;
+            std::vector<std::uint8_t> bytes(p + SIEVE_KERNEL_PATTERN_PADDING, 0xff);
+            for (std::size_t i = 0; i < bytes.size(); ++i) {
+                for (unsigned k = 0; k < 8; ++k) {
+                    if ((30 * i + WHEEL30_RESIDUES[k]) % p == 0) {
+                        bytes[i] &= static_cast<std::uint8_t>(~(1u << k));
+                    }
+                }
+            }
+            result.push_back({p, std::move(bytes)});
+        }
+        return result;
+    }();
+    return patterns;
+}
+
+// Read-only view of wheel bytes over [low, low + 30 * size()), one bit per number coprime to 30.
+// A set bit means "still a candidate" (after sieving: prime). Numbers 2, 3 and 5 are not
+// representable and are left to the caller. The bytes may live in a Wheel30Bitmap or in a mapped
+// cache file.
+class Wheel30View {
+   public:
+    Wheel30View() = default;
+    Wheel30View(const std::uint8_t *bits, std::uint64_t low, std::size_t size)
+        : bits_(bits), low_(low), size_(size) {}
+
+    std::uint64_t low() const { return low_; }
+    std::size_t size() const { return size_; }
+    const std::uint8_t *data() const { return bits_; }
+
+    // Largest number covered by the view, saturating at UINT64_MAX for the last wheel byte
+    // below 2^64.
+    std::uint64_t last() const {
+        std::uint64_t span = 30 * static_cast<std::uint64_t>(size_);
+        if (span == 0) return low_;
+        return span - 1 > UINT64_MAX - low_ ? UINT64_MAX : low_ + span - 1;
+    }
+
+    // Number of set bits standing for numbers in [lo, hi]. The whole bytes in between go to the
+    // sieve kernel's popcount; the partial bytes at both ends are masked.
+    std::uint64_t count(std::uint64_t lo, std::uint64_t hi) const {
+        lo = std::max(lo, low_);
+        hi = std::min(hi, last());
+        if (size_ == 0 || lo > hi) return 0;
+
+        std::size_t first_byte = static_cast<std::size_t>((lo - low_) / 30);
+        std::size_t last_byte = static_cast<std::size_t>((hi - low_) / 30);
+        std::uint8_t first_mask = wheel30_mask_from(static_cast<unsigned>((lo - low_) % 30));
+        std::uint8_t last_mask = static_cast<std::uint8_t>(
+            ~wheel30_mask_from(static_cast<unsigned>((hi - low_) % 30) + 1));
+
+        if (first_byte == last_byte) {
+            return __builtin_popcount(bits_[first_byte] & first_mask & last_mask);
+        }
+        return __builtin_popcount(bits_[first_byte] & first_mask) +
+               __builtin_popcount(bits_[last_byte] & last_mask) +
+               sieve_kernel().popcount(bits_ + first_byte + 1, last_byte - first_byte - 1);
+    }
+
+    // Appends the numbers in [lo, hi] whose bits are set, in ascending order. The whole bytes in
+    // between are expanded by the sieve kernel, a block at a time through a buffer on the stack.
+    template <typename T>
+    void extract(std::uint64_t lo, std::uint64_t hi, std::vector<T> &out) const {
+        static_assert(std::is_same_v<T, std::uint32_t> || std::is_same_v<T, std::uint64_t>,
+                      "primes are extracted as uint32_t or uint64_t");
+        lo = std::max(lo, low_);
+        hi = std::min(hi, last());
+        if (size_ == 0 || lo > hi) return;
+
+        std::size_t first_byte = static_cast<std::size_t>((lo - low_) / 30);
+        std::size_t last_byte = static_cast<std::size_t>((hi - low_) / 30);
+        std::uint8_t first_mask = wheel30_mask_from(static_cast<unsigned>((lo - low_) % 30));
+        std::uint8_t last_mask = static_cast<std::uint8_t>(
+            ~wheel30_mask_from(static_cast<unsigned>((hi - low_) % 30) + 1));
+        if (first_byte == last_byte) {
+            extract_byte(first_byte, bits_[first_byte] & first_mask & last_mask, out);
+            return;
+        }
+
+        extract_byte(first_byte, bits_[first_byte] & first_mask, out);
+        constexpr std::size_t BLOCK = 256;
+        T buffer[8 * BLOCK];
+        const SieveKernel &kernel = sieve_kernel();
+        for (std::size_t i = first_byte + 1; i < last_byte; i += BLOCK) {
+            std::size_t bytes = std::min(BLOCK, last_byte - i);
+            T base = static_cast<T>(low_ + 30 * static_cast<std::uint64_t>(i));
+            std::size_t found;
+            if constexpr (std::is_same_v<T, std::uint32_t>) {
+                found = kernel.expand32(bits_ + i, bytes, base, 30, WHEEL30_RESIDUES, buffer);
+            } else {
+                found = kernel.expand64(bits_ + i, bytes, base, 30, WHEEL30_RESIDUES, buffer);
+            }
+            out.insert(out.end(), buffer, buffer + found);
+        }
+        extract_byte(last_byte, bits_[last_byte] & last_mask, out);
+    }
+
+   private:
+    template <typename T>
+    void extract_byte(std::size_t i, unsigned byte, std::vector<T> &out) const {
+        std::uint64_t base = low_ + 30 * static_cast<std::uint64_t>(i);
+        for (; byte; byte &= byte - 1) {
+            out.push_back(static_cast<T>(base + WHEEL30_RESIDUES[__builtin_ctz(byte)]));
+        }
+    }
+
+    const std::uint8_t *bits_ = nullptr;
+    std::uint64_t low_ = 0;
+    std::size_t size_ = 0;
+};
+
+// Owning, resizable wheel storage that a segment is sieved in. Queries go through view().
+class Wheel30Bitmap {
+   public:
+    Wheel30Bitmap() = default;
+    explicit Wheel30Bitmap(std::size_t bytes) : bits_(bytes) {}
+
+    std::uint64_t low() const { return low_; }
+    std::size_t size() const { return size_; }
+    std::uint8_t *data() { return bits_.data(); }
+    const std::uint8_t *data() const { return bits_.data(); }
+
+    std::uint64_t last() const { return view().last(); }
+
+    // Re-targets the bitmap at [low, low + 30 * bytes) with every bit set. low must be a
+    // multiple of 30. The number 1 is never a candidate.
+    void reset(std::uint64_t low, std::size_t bytes) {
+        low_ = low;
+        size_ = bytes;
+        if (bits_.size() < bytes) bits_.resize(bytes);
+        std::memset(bits_.data(), 0xff, bytes);
+        if (low == 0 && bytes > 0) bits_[0] &= 0xfe;
+    }
+
+    // Like reset(), but starts from wheel30_presieve_pattern(): the multiples of the primes up to
+    // WHEEL30_PRESIEVE_LARGEST are already cleared, the primes themselves are not.
+    void reset_presieved(std::uint64_t low, std::size_t bytes) {
+        const std::vector<std::uint8_t> &pattern = wheel30_presieve_pattern();
+        low_ = low;
+        size_ = bytes;
+        if (bits_.size() < bytes) bits_.resize(bytes);
+        std::size_t offset = static_cast<std::size_t>(low / 30 % WHEEL30_PRESIEVE_PERIOD);
+        for (std::size_t done = 0; done < bytes;) {
+            std::size_t n = std::min(bytes - done, WHEEL30_PRESIEVE_PERIOD - offset);
+            std::memcpy(bits_.data() + done, pattern.data() + offset, n);
+            done += n;
+            offset = 0;
+        }
+        if (low == 0 && bytes > 0) bits_[0] = 0xfe;  // 7 .. 19 are prime, 1 is not
+    }
+
+    // Clears the multiples of the primes from 23 up to kernel.pattern_limit by ANDing in their
+    // wheel30_prime_patterns(), keeping the primes themselves. Works through the bitmap in blocks
+    // of block_bytes, every pattern per block, so that a block stays in L1d for all of them.
+    void clear_pattern_primes(const SieveKernel &kernel, std::size_t block_bytes) {
+        const std::vector<Wheel30PrimePattern> &patterns = wheel30_prime_patterns();
+        for (std::size_t start = 0; start < size_; start += block_bytes) {
+            std::size_t bytes = std::min(block_bytes, size_ - start);
+            for (const Wheel30PrimePattern &pattern : patterns) {
+                std::uint32_t p = pattern.prime;
+                if (p > kernel.pattern_limit) break;
+                kernel.and_pattern(bits_.data() + start, bytes, pattern.bytes.data(), p,
+                                   static_cast<std::size_t>((low_ / 30 + start) % p));
+            }
+        }
+        // The patterns clear each prime along with its multiples; put back those in the bitmap,
+        // wherever it starts.
+        for (const Wheel30PrimePattern &pattern : patterns) {
+            std::uint32_t p = pattern.prime;
+            if (p > kernel.pattern_limit) break;
+            if (p < low_ || (p - low_) / 30 >= size_) continue;
+            bits_[(p - low_) / 30] |= static_cast<std::uint8_t>(1u << WHEEL30_BIT[p % 30]);
+        }
+    }
+
+    // Clears every multiple p * m, m >= p and m coprime to 30, that falls in the bitmap.
+    // p must be a prime >= 7. Works on offsets from low() so it cannot overflow near 2^64.
+    void cross_off(std::uint64_t p) {
+        std::uint64_t offset;
+        unsigned w;
+        if (first_multiple(p, offset, w)) cross_off_from(p, offset, w);
+    }
+
+    // Offset from low() of the first multiple p * m >= low(), m >= p and m coprime to 30, and
+    // the wheel index of m. False if that multiple is above 2^64 - 1.
+    bool first_multiple(std::uint64_t p, std::uint64_t &offset, unsigned &w) const {
+        std::uint64_t m = std::max(p, low_ / p + (low_ % p != 0));
+        m += WHEEL30_ADVANCE[m % 30];
+        if (m > UINT64_MAX / p) return false;
+        offset = p * m - low_;
+        w = WHEEL30_BIT[m % 30];
+        return true;
+    }
+
+    // Clears p's multiples from the one at offset, whose cofactor has wheel index w, to the end of
+    // the bitmap. Returns the offset of the next multiple and leaves w at its cofactor's index, so
+    // that the following segment can carry on without a division.
+    std::uint64_t cross_off_from(std::uint64_t p, std::uint64_t offset, unsigned &w) {
+        std::uint64_t span = 30 * static_cast<std::uint64_t>(size_);
+        for (; offset < span; w = (w + 1) & 7) {
+            bits_[offset / 30] &= static_cast<std::uint8_t>(~(1u << WHEEL30_BIT[offset % 30]));
+            offset += p * WHEEL30_GAPS[w];
+        }
+        return offset;
+    }
+
+    // Clears low() + offset, which must be on the wheel.
+    void cross_off_at(std::uint64_t offset) {
+        bits_[offset / 30] &= static_cast<std::uint8_t>(~(1u << WHEEL30_BIT[offset % 30]));
+    }
+
+    Wheel30View view() const { return Wheel30View(bits_.data(), low_, size_); }
+    std::uint64_t count(std::uint64_t lo, std::uint64_t hi) const { return view().count(lo, hi); }
+
+    template <typename T>
+    void extract(std::uint64_t lo, std::uint64_t hi, std::vector<T> &out) const {
+        view().extract(lo, hi, out);
+    }
+
+   private:
+    std::vector<std::uint8_t> bits_;
+    std::uint64_t low_ = 0;
+    std::size_t size_ = 0;
+};
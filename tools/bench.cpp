@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/argparse.hpp"
+#include "../src/sieve.hpp"
+
+// Per-segment cost of the sieve kernel at a given position: sieves -segments consecutive wheel
+// segments from `start` with every base prime crossed off by hand, then from the pre-sieve pattern
+// with each SIMD kernel the CPU supports, alternating for a few rounds and keeping the best time
+// of each, and checks that all of them leave the same number of candidates. Before timing, every
+// kernel also sieves one segment from 90, where the pattern primes themselves fall, and must leave
+// the same bitmap as crossing off by hand.
+//
+//   build/bench 1000000000000 -segments 2000
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("bench");
+    program.add_argument("start").help("Start of the first segment").scan<'u', uint64_t>();
+    program.add_argument("-segments")
+        .help("Segments to sieve (default: 1000)")
+        .default_value(uint64_t(1000))
+        .scan<'u', uint64_t>();
+    program.add_argument("-segment-size")
+        .help("Segment size in KiB (default: picked from the data caches, as in prime_finder)")
+        .default_value(uint64_t(0))
+        .scan<'u', uint64_t>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    uint64_t segment_kib = program.get<uint64_t>("-segment-size");
+    if (segment_kib && (segment_kib > SIEVE_SEGMENT_MAX_BYTES >> 10 ||
+                        !set_sieve_segment_bytes(segment_kib << 10))) {
+        std::cerr << "Invalid options. -segment-size must be between "
+                  << (SIEVE_SEGMENT_MIN_BYTES >> 10) << " and " << (SIEVE_SEGMENT_MAX_BYTES >> 10)
+                  << " KiB.\n";
+        return 1;
+    }
+    const std::size_t segment_bytes = sieve_segment_bytes();
+    const uint64_t span = 30 * static_cast<uint64_t>(segment_bytes);
+    uint64_t first = program.get<uint64_t>("start") / 30 * 30;
+    uint64_t segments = program.get<uint64_t>("-segments");
+    if (segments < 1 || segments > (UINT64_MAX - first) / span) {
+        std::cerr << "Invalid options. The segments must fit below 2^64.\n";
+        return 1;
+    }
+    uint64_t last = first + segments * span - 1;
+    std::vector<uint32_t> base_primes = generate_primes(static_cast<uint32_t>(isqrt(last)));
+    wheel30_presieve_pattern();  // Built once per process, not part of any segment
+
+    // Sieves the segment at low by hand (no kernel) or with the kernel.
+    auto sieve = [&](Wheel30Bitmap &segment, const SieveKernel *kernel, uint64_t low,
+                     const std::vector<uint32_t> &primes) {
+        uint32_t crossed_up_to = 5;
+        if (kernel) {
+            segment.reset_presieved(low, segment_bytes);
+            segment.clear_pattern_primes(*kernel, sieve_block_bytes());
+            crossed_up_to = kernel->pattern_limit;
+        } else {
+            segment.reset(low, segment_bytes);
+        }
+        for (uint64_t p : primes) {
+            if (p <= crossed_up_to) continue;
+            if (p * p > segment.last()) break;
+            segment.cross_off(p);
+        }
+    };
+
+    std::vector<const SieveKernel *> kernels = {nullptr};
+    for (const SieveKernel &kernel : SIEVE_KERNELS) {
+        if (sieve_kernel_supported(kernel)) kernels.push_back(&kernel);
+    }
+
+    // A segment starting below pattern_limit holds pattern primes that the kernel must keep.
+    const uint64_t check_low = 90;
+    std::vector<uint32_t> check_primes =
+        generate_primes(static_cast<uint32_t>(isqrt(check_low + span - 1)));
+    Wheel30Bitmap expected(segment_bytes), actual(segment_bytes);
+    sieve(expected, nullptr, check_low, check_primes);
+    for (std::size_t i = 1; i < kernels.size(); ++i) {
+        sieve(actual, kernels[i], check_low, check_primes);
+        if (!std::equal(expected.data(), expected.data() + segment_bytes, actual.data())) {
+            std::cerr << "Mismatch: the " << kernels[i]->name << " kernel leaves "
+                      << actual.count(check_low, actual.last())
+                      << " candidates in the segment from " << check_low
+                      << ", crossing off by hand "
+                      << expected.count(check_low, expected.last()) << "\n";
+            return 1;
+        }
+    }
+
+    // Sieves every segment by hand (no kernel) or with the kernel, adds the candidates left to sum
+    // and returns the time per segment in ns.
+    Wheel30Bitmap segment(segment_bytes);
+    auto time_kernel = [&](const SieveKernel *kernel, uint64_t &sum) {
+        force_sieve_kernel(kernel ? kernel->name : "scalar");  // Counting runs on it as well
+        auto start_time = std::chrono::steady_clock::now();
+        for (uint64_t low = first; low < last; low += span) {
+            sieve(segment, kernel, low, base_primes);
+            sum += segment.count(low, segment.last());
+        }
+        std::chrono::duration<double, std::nano> elapsed =
+            std::chrono::steady_clock::now() - start_time;
+        return elapsed.count() / segments;
+    };
+
+    std::vector<double> best_ns(kernels.size());
+    std::vector<uint64_t> checksum(kernels.size());
+    for (int round = 0; round < 3; ++round) {
+        for (std::size_t i = 0; i < kernels.size(); ++i) {
+            checksum[i] = 0;
+            double ns = time_kernel(kernels[i], checksum[i]);
+            best_ns[i] = round == 0 ? ns : std::min(best_ns[i], ns);
+        }
+    }
+
+    std::cout << segments << " segments of " << (segment_bytes >> 10) << " KiB (" << span
+              << " numbers) from " << first << "\n"
+              << "crossing off every prime: " << best_ns[0] / 1000 << " us/segment\n";
+    for (std::size_t i = 1; i < kernels.size(); ++i) {
+        std::string label = std::string("pre-sieve + ") + kernels[i]->name + ":";
+        label.resize(std::max<std::size_t>(label.size(), 25), ' ');
+        std::cout << label << " " << best_ns[i] / 1000 << " us/segment ("
+                  << best_ns[0] / best_ns[i] << "x, patterns up to " << kernels[i]->pattern_limit
+                  << ")\n";
+    }
+    for (std::size_t i = 1; i < kernels.size(); ++i) {
+        if (checksum[i] != checksum[0]) {
+            std::cerr << "Mismatch: " << checksum[0] << " vs " << checksum[i] << " candidates with "
+                      << kernels[i]->name << "\n";
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// Blocking client for the line protocol of prime_finder -serve.
+class QueryClient {
+   public:
+    // Connects to the server's socket. Throws std::runtime_error.
+    explicit QueryClient(const std::string &path) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            throw std::runtime_error("Socket path is too long: " + path);
+        }
+        std::memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+        fd_ = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd_ < 0 || ::connect(fd_, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+            std::string error = std::strerror(errno);
+            if (fd_ >= 0) ::close(fd_);
+            throw std::runtime_error("Cannot connect to " + path + ": " + error);
+        }
+    }
+
+    ~QueryClient() { ::close(fd_); }
+
+    QueryClient(const QueryClient &) = delete;
+    QueryClient &operator=(const QueryClient &) = delete;
+
+    // Sends one request line and returns the reply line without its '\n'.
+    std::string query(const std::string &request) {
+        std::string line = request + "\n";
+        const char *p = line.data();
+        std::size_t left = line.size();
+        while (left > 0) {
+            ssize_t sent = ::send(fd_, p, left, MSG_NOSIGNAL);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0) throw std::runtime_error("Connection lost");
+            p += sent;
+            left -= static_cast<std::size_t>(sent);
+        }
+
+        for (;;) {
+            std::size_t newline = pending_.find('\n');
+            if (newline != std::string::npos) {
+                std::string reply = pending_.substr(0, newline);
+                pending_.erase(0, newline + 1);
+                return reply;
+            }
+            char buffer[1 << 16];
+            ssize_t received = ::read(fd_, buffer, sizeof(buffer));
+            if (received < 0 && errno == EINTR) continue;
+            if (received <= 0) throw std::runtime_error("Connection lost");
+            pending_.append(buffer, static_cast<std::size_t>(received));
+        }
+    }
+
+   private:
+    int fd_ = -1;
+    std::string pending_;
+};
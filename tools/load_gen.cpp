@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../include/argparse.hpp"
+#include "client.hpp"
+
+// Load generator for prime_finder -serve: each connection sends -queries requests back to back,
+// picked at random from is_prime, next, prev, count and range over small windows in [a, b], and
+// the wall-clock time of every request is recorded. Prints throughput and latency percentiles.
+//
+//   build/main 1 1000000000000 -serve /tmp/primes.sock &
+//   build/load_gen /tmp/primes.sock 1 1000000000000 -connections 8 -queries 20000
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("load_gen");
+    program.add_argument("socket").help("Socket of a running prime_finder -serve");
+    program.add_argument("a").help("Start of the served range").scan<'u', uint64_t>();
+    program.add_argument("b").help("End of the served range").scan<'u', uint64_t>();
+    program.add_argument("-connections")
+        .help("Concurrent connections (default: 4)")
+        .default_value(4)
+        .scan<'i', int>();
+    program.add_argument("-queries")
+        .help("Requests per connection (default: 10000)")
+        .default_value(10000)
+        .scan<'i', int>();
+    program.add_argument("-window")
+        .help("Width of count and range queries (default: 10000)")
+        .default_value(uint64_t(10000))
+        .scan<'u', uint64_t>();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    std::string socket = program.get<std::string>("socket");
+    uint64_t a = program.get<uint64_t>("a");
+    uint64_t b = program.get<uint64_t>("b");
+    int connections = program.get<int>("-connections");
+    int queries = program.get<int>("-queries");
+    uint64_t window = program.get<uint64_t>("-window");
+    if (a > b || b - a < window || connections < 1 || queries < 1) {
+        std::cerr << "Invalid options. Ensure a <= b - window and positive counts.\n";
+        return 1;
+    }
+
+    std::vector<std::vector<double>> latencies(connections);
+    std::vector<uint64_t> errors(connections);
+    auto start_time = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int c = 0; c < connections; ++c) {
+        workers.emplace_back([&, c] {
+            std::mt19937_64 rng(c + 1);
+            std::uniform_int_distribution<uint64_t> number(a, b - window);
+            static const char *commands[] = {"is_prime", "next", "prev", "count", "range"};
+            try {
+                QueryClient client(socket);
+                for (int q = 0; q < queries; ++q) {
+                    uint64_t n = number(rng) + 1;
+                    std::string command = commands[rng() % 5];
+                    std::string request = command + " " + std::to_string(n);
+                    if (command == "count" || command == "range") {
+                        request += " " + std::to_string(n + window - 1);
+                    }
+                    auto sent = std::chrono::steady_clock::now();
+                    std::string reply = client.query(request);
+                    std::chrono::duration<double, std::micro> elapsed =
+                        std::chrono::steady_clock::now() - sent;
+                    latencies[c].push_back(elapsed.count());
+                    if (reply.compare(0, 2, "OK") != 0) ++errors[c];
+                }
+            } catch (const std::runtime_error &err) {
+                std::cerr << err.what() << "\n";
+            }
+        });
+    }
+    for (auto &t : workers) {
+        t.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_time;
+
+    std::vector<double> all;
+    uint64_t error_count = 0;
+    for (int c = 0; c < connections; ++c) {
+        all.insert(all.end(), latencies[c].begin(), latencies[c].end());
+        error_count += errors[c];
+    }
+    if (all.empty()) return 1;
+    std::sort(all.begin(), all.end());
+    auto percentile = [&](double p) {
+        return all[std::min(all.size() - 1, static_cast<std::size_t>(p * all.size()))];
+    };
+    std::cout << all.size() << " queries in " << elapsed.count() << " s: "
+              << all.size() / elapsed.count() << " queries/s\n"
+              << "latency us: p50 " << percentile(0.50) << ", p99 " << percentile(0.99)
+              << ", max " << all.back() << "\n";
+    if (error_count) std::cout << error_count << " error replies\n";
+    return 0;
+}
@@ -0,0 +1,31 @@
+#!/bin/sh
+# Checks that -file output to a pipe and to a FIFO, which cannot be truncated or pwrite() to,
+# matches the same output written to a regular file. Run from the repository root after
+# `make build`:
+#
+#   make test
+set -e
+
+main=build/main
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+check() {
+    name=$1
+    shift
+    "$main" "$@" -file "$dir/regular" --hush
+    "$main" "$@" -file /dev/stdout --hush | cat > "$dir/pipe"
+    cmp "$dir/regular" "$dir/pipe"
+    mkfifo "$dir/fifo"
+    cat "$dir/fifo" > "$dir/from_fifo" &
+    "$main" "$@" -file "$dir/fifo" --hush
+    wait
+    cmp "$dir/regular" "$dir/from_fifo"
+    rm -f "$dir/fifo"
+    echo "ok: $name"
+}
+
+check "text" 1 2000000
+check "text, 3 columns, descending" 1 2000000 -columns 3 -sort desc
+check "bin" 1 2000000 -format bin
+check "64-bit text" 18446744073709000000 18446744073709551615
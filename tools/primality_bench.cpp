@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "../include/argparse.hpp"
+#include "../src/primality.hpp"
+
+// Average cost per number of trial division and of Miller-Rabin over -count consecutive numbers
+// starting at each power of two from 2^8 up, checking that both agree. Trial division is only
+// timed while it stays affordable, both as the 6k +- 1 reference and, below TRIAL_DIVISION_LIMIT,
+// as is_prime_small() by the precomputed inverses that is_prime() uses. The first power of two
+// where Miller-Rabin beats the latter on average is where IS_PRIME_TRIAL_LIMIT belongs; if it
+// never does below TRIAL_DIVISION_LIMIT, the limit is the table's reach instead. Below
+// 2^32 the hashed single-base test of -engine mr32 is timed as well, and at every size
+// test_batch(), which the per-number engines run: batches of 1024 candidates through the -kernel
+// trial division, then is_prime() for the survivors.
+//
+//   build/primality_bench -count 20000 -kernel avx2
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("primality_bench");
+    program.add_argument("-count")
+        .help("Consecutive numbers tested at each size (default: 20000)")
+        .default_value(uint64_t(20000))
+        .scan<'u', uint64_t>();
+    program.add_argument("-kernel")
+        .help("Trial division kernel of test_batch() (default: the best one this CPU supports)")
+        .default_value(std::string("auto"));
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+    uint64_t count = std::max<uint64_t>(program.get<uint64_t>("-count"), 1);
+    std::string kernel_name = program.get<std::string>("-kernel");
+    if (kernel_name != "auto" && !force_sieve_kernel(kernel_name)) {
+        std::cerr << "The '" << kernel_name
+                  << "' kernel does not exist or this CPU cannot run it\n";
+        return 1;
+    }
+
+    // Runs test over [start, start + count), adds the primes found to primes and returns the
+    // time per number in ns. The best of three rounds counts.
+    auto time_test = [&](uint64_t start, auto test, uint64_t &primes) {
+        double best = 0;
+        for (int round = 0; round < 3; ++round) {
+            primes = 0;
+            auto start_time = std::chrono::steady_clock::now();
+            for (uint64_t n = start; n - start < count; ++n) primes += test(n);
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start_time;
+            double ns = elapsed.count() / count;
+            best = round == 0 ? ns : std::min(best, ns);
+        }
+        return best;
+    };
+
+    // The same over test_batch() in batches of 1024.
+    auto time_batch = [&](uint64_t start, uint64_t &primes) {
+        std::vector<uint64_t> values(1024);
+        std::vector<uint8_t> prime(1024);
+        double best = 0;
+        for (int round = 0; round < 3; ++round) {
+            primes = 0;
+            auto start_time = std::chrono::steady_clock::now();
+            for (uint64_t n = start; n - start < count;) {
+                std::size_t size = std::min<uint64_t>(values.size(), count - (n - start));
+                for (std::size_t i = 0; i < size; ++i) values[i] = n++;
+                test_batch(values.data(), size, prime.data(), is_prime<uint64_t>);
+                for (std::size_t i = 0; i < size; ++i) primes += prime[i];
+            }
+            std::chrono::duration<double, std::nano> elapsed =
+                std::chrono::steady_clock::now() - start_time;
+            double ns = elapsed.count() / count;
+            best = round == 0 ? ns : std::min(best, ns);
+        }
+        return best;
+    };
+
+    std::cout << "test_batch() kernel: " << sieve_kernel().name << "\n";
+    bool crossover_found = false;
+    double trial_ns = 0;
+    for (int bits = 8; bits < 64; ++bits) {
+        uint64_t start = uint64_t(1) << bits;
+        uint64_t mr_primes;
+        double mr_ns = time_test(start, is_prime_miller_rabin, mr_primes);
+        std::cout << "2^" << bits << ": miller-rabin " << mr_ns << " ns/number";
+        uint64_t batch_primes;
+        double batch_ns = time_batch(start, batch_primes);
+        std::cout << ", batched " << batch_ns << " ns/number";
+        if (batch_primes != mr_primes) {
+            std::cerr << "\nMismatch at 2^" << bits << ": " << batch_primes << " vs " << mr_primes
+                      << " primes\n";
+            return 1;
+        }
+        if (bits < 32) {
+            uint64_t mr32_primes;
+            double mr32_ns = time_test(start, [](uint64_t n) { return is_prime_mr32(n); },
+                                       mr32_primes);
+            std::cout << ", mr32 " << mr32_ns << " ns/number";
+            if (mr32_primes != mr_primes) {
+                std::cerr << "\nMismatch at 2^" << bits << ": " << mr32_primes << " vs "
+                          << mr_primes << " primes\n";
+                return 1;
+            }
+        }
+        // Trial division grows with sqrt(n); stop once it is 100x slower.
+        if (trial_ns < 100 * mr_ns) {
+            uint64_t trial_primes;
+            trial_ns = time_test(start, is_prime_trial<uint64_t>, trial_primes);
+            std::cout << ", trial division " << trial_ns << " ns/number";
+            if (trial_primes != mr_primes) {
+                std::cerr << "\nMismatch at 2^" << bits << ": " << trial_primes << " vs "
+                          << mr_primes << " primes\n";
+                return 1;
+            }
+        }
+        // The crossover is only meaningful against is_prime_small(), which is_prime() runs.
+        if (start + count <= TRIAL_DIVISION_LIMIT) {
+            uint64_t small_primes;
+            double small_ns = time_test(start, [](uint64_t n) { return is_prime_small(n); },
+                                        small_primes);
+            std::cout << ", by inverses " << small_ns << " ns/number";
+            if (small_primes != mr_primes) {
+                std::cerr << "\nMismatch at 2^" << bits << ": " << small_primes << " vs "
+                          << mr_primes << " primes\n";
+                return 1;
+            }
+            if (!crossover_found && mr_ns < small_ns) {
+                crossover_found = true;
+                std::cout << "  <- Miller-Rabin wins from here";
+            }
+        }
+        std::cout << " (" << mr_primes << " primes)\n";
+    }
+    if (!crossover_found) {
+        std::cout << "Trial division by inverses beats Miller-Rabin up to TRIAL_DIVISION_LIMIT ("
+                  << TRIAL_DIVISION_LIMIT << "); IS_PRIME_TRIAL_LIMIT is bound by the table\n";
+    }
+    return 0;
+}
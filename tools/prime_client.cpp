@@ -0,0 +1,44 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/argparse.hpp"
+#include "client.hpp"
+
+// Sends queries to a prime_finder -serve socket and prints the replies, one per line. Queries come
+// from the command line or, if there are none, from stdin:
+//
+//   build/prime_client /tmp/primes.sock "count 1 1000000" "next 1000000"
+int main(int argc, char *argv[]) {
+    argparse::ArgumentParser program("prime_client");
+    program.add_argument("socket").help("Socket of a running prime_finder -serve");
+    program.add_argument("queries")
+        .help("Queries such as \"is_prime 97\"; read from stdin when omitted")
+        .remaining();
+
+    try {
+        program.parse_args(argc, argv);
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << std::endl;
+        std::cerr << program;
+        return 1;
+    }
+
+    try {
+        QueryClient client(program.get<std::string>("socket"));
+        std::vector<std::string> queries =
+            program.present<std::vector<std::string>>("queries").value_or(
+                std::vector<std::string>{});
+        if (queries.empty()) {
+            for (std::string line; std::getline(std::cin, line);) {
+                std::cout << client.query(line) << "\n";
+            }
+        } else {
+            for (const std::string &query : queries) std::cout << client.query(query) << "\n";
+        }
+    } catch (const std::runtime_error &err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    return 0;
+}